@@ -0,0 +1,196 @@
+#ifndef FrameClock_hpp
+#define FrameClock_hpp
+
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include <fmt/core.h>
+
+// Paces the main loop to an output frame rate. Every frame's time is worked
+// out from the start and the frame number, so nothing builds up over a long
+// run, and rates such as 30000/1001 are exact where whole milliseconds can't be.
+namespace FrameClock {
+  using Clock = std::chrono::steady_clock;
+
+  // Frames per second as numerator / denominator, as NDI has them
+  struct Rate {
+    int64_t numerator = 25;
+    int64_t denominator = 1;
+
+    // All of it as digits
+    static auto whole(std::string_view text) -> std::optional<int64_t> {
+      auto value = int64_t{0};
+      auto const end = text.data() + text.size();
+      auto const [last, error] = std::from_chars(text.data(), end, value);
+      if (text.empty() || text.front() == '-' || error != std::errc{} || last != end) {
+        return std::nullopt;
+      }
+      return value;
+    }
+
+    // "25", "30000/1001", "12.5" for 25/2, or "29.97" for 30000/1001 and the
+    // other NTSC rates. Empty for anything else or more than NDI can take.
+    static auto parse(std::string const & text) -> std::optional<Rate> {
+      auto rate = Rate{};
+      if (auto const slash = text.find('/'); slash != std::string::npos) {
+        auto const numerator = whole(std::string_view{text}.substr(0, slash));
+        auto const denominator = whole(std::string_view{text}.substr(slash + 1));
+        if (!numerator || !denominator) {
+          return std::nullopt;
+        }
+        rate = {*numerator, *denominator};
+      } else {
+        auto const point = text.find('.');
+        auto const integral = whole(std::string_view{text}.substr(0, point));
+        if (!integral) {
+          return std::nullopt;
+        }
+        rate = {*integral, 1};
+        if (point != std::string::npos) {
+          auto const digits = std::string_view{text}.substr(point + 1);
+          auto const fraction = whole(digits);
+          if (!fraction || digits.size() > 9 || *integral > std::numeric_limits<int>::max()) {
+            return std::nullopt;
+          }
+          for (auto i = size_t{0}; i < digits.size(); ++i) {
+            rate.denominator *= 10;
+          }
+          rate.numerator = *integral * rate.denominator + *fraction;
+          auto const perSecond = static_cast<double>(rate.numerator) / rate.denominator;
+          auto const ntsc = perSecond * 1001 / 1000;
+          if (*fraction != 0 && std::abs(ntsc - std::round(ntsc)) < 0.01) {
+            rate = {std::llround(ntsc) * 1000, 1001};
+          }
+        }
+      }
+      if (rate.numerator <= 0 || rate.denominator <= 0) {
+        return std::nullopt;
+      }
+      auto const common = std::gcd(rate.numerator, rate.denominator);
+      rate = {rate.numerator / common, rate.denominator / common};
+      if (rate.numerator > std::numeric_limits<int>::max() || rate.denominator > std::numeric_limits<int>::max()) {
+        return std::nullopt;
+      }
+      return rate;
+    }
+
+    // The frames a second counted in timecode, 30 for 29.97
+    auto nominal() const -> int64_t { return (numerator + denominator / 2) / denominator; }
+
+    // 29.97 and 59.94 timecode skips frame numbers to keep up with the clock
+    auto dropFrame() const { return denominator == 1001 && nominal() % 30 == 0; }
+
+    // When the frame is due after the first, rounded up to the nanosecond.
+    // Whole seconds' worth of frames first so it doesn't overflow.
+    auto offset(uint64_t frame) const -> std::chrono::nanoseconds {
+      constexpr auto second = int64_t{1'000'000'000};
+      auto const n = static_cast<uint64_t>(numerator);
+      auto const whole = static_cast<int64_t>(frame / n);
+      auto const rest = static_cast<int64_t>(frame % n);
+      return std::chrono::nanoseconds{whole * denominator * second + (rest * denominator * second + numerator - 1) / numerator};
+    }
+
+    // The last frame due by then, the inverse of offset
+    auto frame(std::chrono::nanoseconds since) const -> uint64_t {
+      constexpr auto second = int64_t{1'000'000'000};
+      if (since.count() < 0) {
+        return 0;
+      }
+      auto const seconds = since.count() / second;
+      auto const rest = since.count() % second;
+      return static_cast<uint64_t>((seconds * numerator + rest * numerator / second) / denominator);
+    }
+  };
+
+  // SMPTE timecode, HH:MM:SS:FF, or HH:MM:SS;FF when it drops frames
+  inline auto timecode(Rate rate, uint64_t frame) -> std::string {
+    auto const fps = static_cast<uint64_t>(rate.nominal());
+    if (rate.dropFrame()) {
+      // Two frame numbers a minute at 29.97, four at 59.94, but not in every
+      // tenth minute
+      auto const dropped = fps / 15;
+      auto const perMinute = fps * 60 - dropped;
+      auto const perTenMinutes = fps * 600 - dropped * 9;
+      auto const tens = frame / perTenMinutes;
+      auto const rest = frame % perTenMinutes;
+      frame += dropped * 9 * tens;
+      if (rest > dropped) {
+        frame += dropped * ((rest - dropped) / perMinute);
+      }
+    }
+    return fmt::format
+      ( "{:02}:{:02}:{:02}{}{:02}"
+      , frame / (fps * 3600) % 24
+      , frame / (fps * 60) % 60
+      , frame / fps % 60
+      , rate.dropFrame() ? ';' : ':'
+      , frame % fps
+      );
+  }
+
+  class FrameClock {
+    private:
+      Rate rate;
+      Clock::time_point start = Clock::now();
+      // Sleeping can wake late by up to a scheduler tick, so the last of
+      // the wait is spent spinning
+      Clock::duration spin;
+      uint64_t next = 0;
+      uint64_t dropped = 0;
+
+    public:
+      explicit FrameClock(Rate rate, Clock::duration spin = std::chrono::microseconds{500})
+        : rate{rate}
+        , spin{spin}
+        {}
+
+      auto frameRate() const { return rate; }
+
+      // Frame 0 is due when the clock was made
+      auto deadline(uint64_t frame) const { return start + rate.offset(frame); }
+
+      auto frame(Clock::time_point now = Clock::now()) const { return rate.frame(now - start); }
+
+      auto timecode(uint64_t frame) const { return ::FrameClock::timecode(rate, frame); }
+
+      // Frames that were already late when waited for and so were skipped
+      auto droppedFrames() const { return dropped; }
+
+      // Waits for the next frame to be due and returns its number. When the
+      // loop has fallen behind it goes straight on with the latest frame.
+      auto wait() -> uint64_t {
+        auto const due = frame();
+        if (due > next) {
+          dropped += due - next;
+          next = due;
+        }
+        auto const until = deadline(next);
+        if (Clock::now() < until - spin) {
+          std::this_thread::sleep_until(until - spin);
+        }
+        while (Clock::now() < until) {
+          std::this_thread::yield();
+        }
+        return next++;
+      }
+
+      auto json() const -> std::string {
+        auto const now = frame();
+        return fmt::format
+          ( R"({{"rate":[{},{}],"frame":{},"timecode":"{}","dropped_frames":{}}})"
+          , rate.numerator, rate.denominator
+          , now, timecode(now), dropped
+          );
+      }
+  };
+}
+
+#endif
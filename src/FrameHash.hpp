@@ -0,0 +1,147 @@
+#ifndef FrameHash_hpp
+#define FrameHash_hpp
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include "Kernels.hpp"
+#include "Light2D.hpp"
+#include "ThreadPool.hpp"
+
+// Tells which parts of a source's frames are actually different from the last
+// one, so repaints of the same content and frozen inputs aren't uploaded or
+// composited again, and how long it has been since anything changed.
+namespace FrameHash {
+  using Clock = std::chrono::steady_clock;
+
+  class Tiles {
+    public:
+      static constexpr auto tileSize = L2D::Size{64, 16};
+
+    private:
+      L2D::Size size;
+      int columns;
+      int rows;
+      std::vector<uint64_t> hashes;
+      // Bytes rather than bits so the threads can write them at once
+      std::vector<uint8_t> touched;
+      std::vector<uint8_t> changed;
+      // Nothing to compare the first frame with
+      bool known = false;
+
+      uint64_t frames = 0;
+      uint64_t unchangedFrames = 0;
+      Clock::time_point lastChange = Clock::now();
+
+      auto tile(int column, int row) const {
+        return L2D::Rect{{column * tileSize.w, row * tileSize.h}, tileSize} & L2D::Rect{{0, 0}, size};
+      }
+
+    public:
+      explicit Tiles(L2D::Size size)
+        : size{size}
+        , columns{(size.w + tileSize.w - 1) / tileSize.w}
+        , rows{(size.h + tileSize.h - 1) / tileSize.h}
+        , hashes(columns * rows)
+        , touched(columns * rows)
+        , changed(columns * rows)
+        {}
+
+      // The tiles in rects whose pixels are different from the last frame,
+      // joined along each row of tiles. All of the tiles in rects the first
+      // time. Pixels are BGRA and the size given to the constructor.
+      auto update(uint8_t const * pixels, int pitch, std::vector<L2D::Rect> const & rects) -> std::vector<L2D::Rect> {
+        std::fill(touched.begin(), touched.end(), 0);
+        for (auto rect : rects) {
+          rect = rect & L2D::Rect{{0, 0}, size};
+          if (rect.empty()) {
+            continue;
+          }
+          for (auto row = rect.top() / tileSize.h; row <= (rect.bottom() - 1) / tileSize.h; ++row) {
+            for (auto column = rect.left() / tileSize.w; column <= (rect.right() - 1) / tileSize.w; ++column) {
+              touched[row * columns + column] = 1;
+            }
+          }
+        }
+
+        ThreadPool::ThreadPool::shared().forEach(static_cast<size_t>(rows), [this, pixels, pitch](size_t tileRow) {
+          auto const row = static_cast<int>(tileRow);
+          for (auto column = 0; column < columns; ++column) {
+            auto const i = row * columns + column;
+            changed[i] = 0;
+            if (!touched[i]) {
+              continue;
+            }
+            auto const rect = tile(column, row);
+            auto hash = uint64_t{0};
+            for (auto y = rect.top(); y < rect.bottom(); ++y) {
+              hash = Kernels::hash(pixels + y * pitch + rect.x * 4, rect.w * 4, hash);
+            }
+            changed[i] = !known || hash != hashes[i];
+            hashes[i] = hash;
+          }
+        });
+
+        // Tiles not touched keep their hashes from before, so only known once all have been
+        known = known || std::all_of(touched.begin(), touched.end(), [](auto t) { return t != 0; });
+
+        auto result = std::vector<L2D::Rect>{};
+        for (auto row = 0; row < rows; ++row) {
+          auto const first = result.size();
+          for (auto column = 0; column < columns; ++column) {
+            if (!changed[row * columns + column]) {
+              continue;
+            }
+            auto const rect = tile(column, row);
+            if (result.size() > first && result.back().right() == rect.left()) {
+              result.back().w += rect.w;
+            } else {
+              result.push_back(rect);
+            }
+          }
+        }
+
+        frames += 1;
+        if (result.empty()) {
+          unchangedFrames += 1;
+        } else {
+          unchangedFrames = 0;
+          lastChange = Clock::now();
+        }
+        return result;
+      }
+
+      auto update(uint8_t const * pixels, int pitch) -> std::vector<L2D::Rect> {
+        return update(pixels, pitch, {{{0, 0}, size}});
+      }
+
+      // For a new source, its first frame is all changed
+      void reset() {
+        known = false;
+        frames = 0;
+        unchangedFrames = 0;
+        lastChange = Clock::now();
+      }
+
+      auto unchangedFor() const { return Clock::now() - lastChange; }
+
+      // Nothing has changed for a while, whether the frames kept coming or not
+      auto frozen(Clock::duration after) const { return unchangedFor() >= after; }
+
+      auto json(Clock::duration frozenAfter) const -> std::string {
+        return fmt::format
+          ( R"({{"frames":{},"unchanged_frames":{},"unchanged_seconds":{:.1f},"frozen":{}}})"
+          , frames, unchangedFrames
+          , std::chrono::duration<double>{unchangedFor()}.count()
+          , frozen(frozenAfter)
+          );
+      }
+  };
+}
+
+#endif
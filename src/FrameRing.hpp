@@ -0,0 +1,250 @@
+#ifndef FrameRing_hpp
+#define FrameRing_hpp
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A ring of frames in POSIX shared memory for other processes on the same
+// machine. There is one writer and any number of readers, which map it read
+// only and read the frames in place. Each slot has a sequence number that is
+// odd while the slot is being written, so a reader can tell if a frame was
+// overwritten while it was reading it.
+//
+// Frames are BGRA with the colour premultiplied, the fill on the left and the
+// key on the right as in the window.
+//
+// This header has no other dependencies so consumers can include it on its own.
+namespace FrameRing {
+  constexpr auto magic = uint32_t{0x4B46524E}; // KFRN
+  constexpr auto version = uint32_t{1};
+  constexpr auto formatBGRA = uint32_t{0x41524742}; // 'BGRA'
+
+  static_assert(std::atomic<uint64_t>::is_always_lock_free, "The sequence numbers have to work between processes");
+
+  struct Header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slots;
+    // From the start of one slot to the next, a multiple of the page size
+    uint32_t slotBytes;
+    // The number of the newest complete frame, 0 before the first
+    std::atomic<uint64_t> latest;
+  };
+
+  struct SlotHeader {
+    std::atomic<uint64_t> sequence;
+    uint64_t frame;
+    // std::chrono::steady_clock, which is CLOCK_MONOTONIC so the same in every process
+    int64_t timestampNs;
+    uint32_t format;
+    // Of each of the fill and the key
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    // From the start of the pixels
+    uint32_t keyOffset;
+  };
+
+  // The slot header is followed by the pixels at this offset
+  constexpr auto pixelsOffset = size_t{64};
+  static_assert(sizeof(SlotHeader) <= pixelsOffset);
+
+  inline auto pageAligned(size_t bytes) -> size_t {
+    auto const page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return (bytes + page - 1) / page * page;
+  }
+
+  class Writer {
+    private:
+      std::string name;
+      int fd;
+      void* base;
+      size_t size;
+
+      uint32_t width;
+      uint32_t height;
+      uint32_t stride;
+
+      auto header() const { return static_cast<Header*>(base); }
+      auto slot(uint64_t frame) const {
+        auto const h = header();
+        return reinterpret_cast<SlotHeader*>(static_cast<uint8_t*>(base) + pageAligned(sizeof(Header)) + (frame % h->slots) * h->slotBytes);
+      }
+
+      Writer(std::string name, int fd, void* base, size_t size, uint32_t width, uint32_t height)
+        : name{std::move(name)}
+        , fd{fd}
+        , base{base}
+        , size{size}
+        , width{width}
+        , height{height}
+        , stride{width * 2 * 4}
+        {}
+
+    public:
+      // name is a shm_open name, so starts with a /. Returns nullptr on failure.
+      static auto create(std::string name, uint32_t width, uint32_t height, uint32_t slots = 4) -> std::unique_ptr<Writer> {
+        auto const slotBytes = pageAligned(pixelsOffset + size_t{width} * 2 * 4 * height);
+        auto const size = pageAligned(sizeof(Header)) + slots * slotBytes;
+
+        // Readers left mapping an old ring keep it, a new one is made from scratch
+        shm_unlink(name.c_str());
+        auto const fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (fd < 0) {
+          return nullptr;
+        }
+        if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+          close(fd);
+          shm_unlink(name.c_str());
+          return nullptr;
+        }
+        auto const base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED) {
+          close(fd);
+          shm_unlink(name.c_str());
+          return nullptr;
+        }
+
+        auto const header = new(base) Header{magic, version, slots, static_cast<uint32_t>(slotBytes), {}};
+        header->latest.store(0, std::memory_order_relaxed);
+        for (uint32_t i = 0; i < slots; ++i) {
+          auto const slot = new(static_cast<uint8_t*>(base) + pageAligned(sizeof(Header)) + i * slotBytes) SlotHeader{};
+          slot->sequence.store(0, std::memory_order_relaxed);
+        }
+        // Only published to readers once the magic is in place
+        std::atomic_thread_fence(std::memory_order_release);
+
+        return std::unique_ptr<Writer>{new Writer{std::move(name), fd, base, size, width, height}};
+      }
+
+      Writer(Writer const &) = delete;
+      Writer& operator=(Writer const &) = delete;
+
+      ~Writer() {
+        munmap(base, size);
+        close(fd);
+        shm_unlink(name.c_str());
+      }
+
+      // pixels has the fill on the left and the key on the right, each width by height
+      void write(uint64_t frame, uint8_t const * pixels, int pitch) {
+        auto const slot = this->slot(frame);
+        auto const sequence = slot->sequence.load(std::memory_order_relaxed);
+
+        slot->sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        slot->frame = frame;
+        slot->timestampNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        slot->format = formatBGRA;
+        slot->width = width;
+        slot->height = height;
+        slot->stride = stride;
+        slot->keyOffset = width * 4;
+        auto const dst = reinterpret_cast<uint8_t*>(slot) + pixelsOffset;
+        if (static_cast<uint32_t>(pitch) == stride) {
+          std::memcpy(dst, pixels, size_t{stride} * height);
+        } else {
+          for (uint32_t y = 0; y < height; ++y) {
+            std::memcpy(dst + y * stride, pixels + y * pitch, stride);
+          }
+        }
+
+        slot->sequence.store(sequence + 2, std::memory_order_release);
+        header()->latest.store(frame, std::memory_order_release);
+      }
+  };
+
+  struct View {
+    uint64_t frame;
+    int64_t timestampNs;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    uint8_t const * fill;
+    uint8_t const * key;
+  };
+
+  class Reader {
+    private:
+      void const * base;
+      size_t size;
+
+      auto header() const { return static_cast<Header const *>(base); }
+
+      Reader(void const * base, size_t size) : base{base}, size{size} {}
+
+    public:
+      // Returns nullptr if there is no ring with this name
+      static auto open(std::string const & name) -> std::unique_ptr<Reader> {
+        auto const fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0) {
+          return nullptr;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(Header)) {
+          close(fd);
+          return nullptr;
+        }
+        auto const size = static_cast<size_t>(info.st_size);
+        auto const base = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        // The mapping keeps the memory
+        close(fd);
+        if (base == MAP_FAILED) {
+          return nullptr;
+        }
+
+        auto reader = std::unique_ptr<Reader>{new Reader{base, size}};
+        std::atomic_thread_fence(std::memory_order_acquire);
+        auto const header = reader->header();
+        if (header->magic != magic || header->version != version || pageAligned(sizeof(Header)) + size_t{header->slots} * header->slotBytes > size) {
+          return nullptr;
+        }
+        return reader;
+      }
+
+      Reader(Reader const &) = delete;
+      Reader& operator=(Reader const &) = delete;
+
+      ~Reader() {
+        munmap(const_cast<void*>(base), size);
+      }
+
+      auto latest() const { return header()->latest.load(std::memory_order_acquire); }
+
+      // Calls f with the newest frame if it is newer than after. The view
+      // points into the ring, so returns false if the frame was overwritten
+      // while f was reading it and what f read can't be trusted.
+      template <typename F>
+      auto read(uint64_t after, F&& f) const -> bool {
+        auto const frame = latest();
+        if (frame == 0 || frame <= after) {
+          return false;
+        }
+        auto const header = this->header();
+        auto const slot = reinterpret_cast<SlotHeader const *>(static_cast<uint8_t const *>(base) + pageAligned(sizeof(Header)) + (frame % header->slots) * header->slotBytes);
+
+        auto const before = slot->sequence.load(std::memory_order_acquire);
+        if (before % 2 != 0 || slot->frame != frame) {
+          return false;
+        }
+        auto const pixels = reinterpret_cast<uint8_t const *>(slot) + pixelsOffset;
+        f(View{slot->frame, slot->timestampNs, slot->width, slot->height, slot->stride, pixels, pixels + slot->keyOffset});
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return slot->sequence.load(std::memory_order_relaxed) == before;
+      }
+  };
+}
+
+#endif
@@ -0,0 +1,986 @@
+#ifndef Kernels_hpp
+#define Kernels_hpp
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define KERNELS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang only allow instructions a function is marked for, so the
+// vector kernels can be built without raising the baseline for everything.
+// MSVC allows any.
+#if defined(KERNELS_X86) && !defined(_MSC_VER)
+#define KERNELS_TARGET(isa) __attribute__((target(isa)))
+#else
+#define KERNELS_TARGET(isa)
+#endif
+
+// Pixel loops for compositing on the CPU. Pixels are BGRA with the colour
+// premultiplied by the alpha.
+//
+// There is a version of each for every instruction set, picked at runtime
+// for the CPU. They all give exactly the same results.
+namespace Kernels {
+  enum class Level { Scalar, SSE41, AVX2, AVX512 };
+
+  // How split writes the fill and key for outputs that take them separately
+  struct Split {
+    enum class Key
+      // BGRA, the alpha as an opaque grey
+      { Grey
+      // One byte per pixel
+      , Alpha
+      };
+
+    // The colour divided by the alpha, the alpha is kept in the fill
+    bool straight = false;
+    // 16 to 235 rather than 0 to 255, for the colour and the key
+    bool legal = false;
+    Key key = Key::Grey;
+  };
+
+  // For hash, four 64 bit lanes mixed with a different part of it for each
+  // 32 byte stripe, then scrambled with the end of it every 32 stripes, as
+  // in XXH3. From splitmix64 so it has no pattern.
+  constexpr auto hashStripe = 32;
+  constexpr auto hashStripesPerBlock = 32;
+  constexpr auto hashSecret = [] {
+    auto secret = std::array<uint64_t, hashStripesPerBlock + 8>{};
+    auto x = uint64_t{0};
+    for (auto& s : secret) {
+      x += 0x9E3779B97F4A7C15;
+      auto z = x;
+      z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+      z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+      s = z ^ (z >> 31);
+    }
+    return secret;
+  }();
+
+  // The pixels of a row from left up to right aren't transparent, none of
+  // them if left == right
+  struct Coverage {
+    int left = 0;
+    int right = 0;
+    // Every pixel in the row has an alpha of 255
+    bool opaque = false;
+  };
+
+  // lerp weights are out of this, so a 16 bit value times one fits in 31 bits
+  constexpr auto lerpOne = uint32_t{1} << 15;
+
+  namespace Scalar {
+    // x / 255, rounded, for x up to 255 * 255
+    inline auto div255(uint32_t x) -> uint32_t {
+      x += 128;
+      return (x + (x >> 8)) >> 8;
+    }
+
+    // dst = src * opacity + dst * (1 - src alpha * opacity)
+    inline void over(uint8_t* dst, uint8_t const * src, int pixels, uint32_t opacity) {
+      for (auto i = 0; i < pixels * 4; i += 4) {
+        auto const alpha = div255(src[i + 3] * opacity);
+        for (auto c = 0; c < 4; ++c) {
+          // Clamped in case the source isn't properly premultiplied
+          dst[i + c] = static_cast<uint8_t>(std::min<uint32_t>(div255(src[i + c] * opacity) + div255(dst[i + c] * (255 - alpha)), 255));
+        }
+      }
+    }
+
+    // As over, but the source is stepped through in 16.16 fixed point for scaling
+    inline void overScaled(uint8_t* dst, uint8_t const * srcRow, int pixels, uint32_t srcX, uint32_t step, uint32_t opacity) {
+      for (auto i = 0; i < pixels; ++i, srcX += step) {
+        over(dst + i * 4, srcRow + (srcX >> 16) * 4, 1, opacity);
+      }
+    }
+
+    // The key is the alpha of the fill as an opaque grey
+    inline void keyFromAlpha(uint8_t* key, uint8_t const * fill, int pixels) {
+      for (auto i = 0; i < pixels * 4; i += 4) {
+        auto const alpha = fill[i + 3];
+        key[i + 0] = alpha;
+        key[i + 1] = alpha;
+        key[i + 2] = alpha;
+        key[i + 3] = 255;
+      }
+    }
+
+    inline auto coverage(uint8_t const * src, int pixels) -> Coverage {
+      auto left = 0;
+      while (left < pixels && src[left * 4 + 3] == 0) {
+        ++left;
+      }
+      if (left == pixels) {
+        return {};
+      }
+      auto right = pixels;
+      while (src[(right - 1) * 4 + 3] == 0) {
+        --right;
+      }
+      auto opaque = left == 0 && right == pixels;
+      for (auto i = 0; opaque && i < pixels; ++i) {
+        opaque = src[i * 4 + 3] == 255;
+      }
+      return {left, right, opaque};
+    }
+
+    inline void hashAccumulate(uint64_t* acc, uint8_t const * src, uint64_t const * key) {
+      for (auto i = 0; i < 4; ++i) {
+        auto data = uint64_t{};
+        std::memcpy(&data, src + i * 8, 8);
+        auto const mixed = data ^ key[i];
+        acc[i ^ 1] += data;
+        acc[i] += (mixed & 0xFFFFFFFF) * (mixed >> 32);
+      }
+    }
+
+    inline void hashScramble(uint64_t* acc) {
+      for (auto i = 0; i < 4; ++i) {
+        acc[i] ^= acc[i] >> 47;
+        acc[i] ^= hashSecret[hashStripesPerBlock + 4 + i];
+        acc[i] *= 0x9E3779B1;
+      }
+    }
+
+    inline auto hashAvalanche(uint64_t h) -> uint64_t {
+      h ^= h >> 37;
+      h *= 0x165667919E3779F9;
+      return h ^ (h >> 32);
+    }
+
+    // Any bytes left over after the whole stripes, then the lanes together
+    inline auto hashFinish(uint64_t* acc, uint8_t const * src, int bytes, int stripe, uint64_t length) -> uint64_t {
+      if (bytes > 0) {
+        uint8_t last[hashStripe] = {};
+        std::memcpy(last, src, bytes);
+        hashAccumulate(acc, last, hashSecret.data() + stripe);
+      }
+      auto h = length * 0x9E3779B185EBCA87;
+      for (auto i = 0; i < 4; ++i) {
+        h = hashAvalanche(h ^ acc[i]) * 0xC2B2AE3D27D4EB4F;
+      }
+      return hashAvalanche(h);
+    }
+
+    // Not cryptographic, for telling whether pixels changed. Rows can be
+    // chained by passing the hash of the previous one as the seed.
+    inline auto hash(uint8_t const * src, int bytes, uint64_t seed) -> uint64_t {
+      uint64_t acc[4] = {seed ^ hashSecret[0], seed ^ hashSecret[1], seed ^ hashSecret[2], seed ^ hashSecret[3]};
+      auto stripe = 0;
+      auto i = 0;
+      for (; i + hashStripe <= bytes; i += hashStripe) {
+        hashAccumulate(acc, src + i, hashSecret.data() + stripe);
+        if (++stripe == hashStripesPerBlock) {
+          hashScramble(acc);
+          stripe = 0;
+        }
+      }
+      return hashFinish(acc, src + i, bytes - i, stripe, static_cast<uint64_t>(bytes));
+    }
+
+    // 255 / alpha in 16.16 fixed point
+    inline auto unpremultiply() -> std::array<uint32_t, 256> const & {
+      static auto const table = [] {
+        auto table = std::array<uint32_t, 256>{};
+        for (uint32_t alpha = 1; alpha < 256; ++alpha) {
+          table[alpha] = ((255u << 16) + alpha / 2) / alpha;
+        }
+        return table;
+      }();
+      return table;
+    }
+
+    // sRGB to linear light out of 65535
+    inline auto toLinear() -> std::array<uint32_t, 256> const & {
+      static auto const table = [] {
+        auto table = std::array<uint32_t, 256>{};
+        for (auto x = 0; x < 256; ++x) {
+          auto const c = x / 255.0;
+          auto const linear = c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4);
+          table[x] = static_cast<uint32_t>(std::lround(linear * 65535));
+        }
+        return table;
+      }();
+      return table;
+    }
+
+    // Linear light back to sRGB, by the top 12 of its 16 bits. Each sRGB
+    // value comes back as it went in.
+    inline auto fromLinear() -> std::array<uint32_t, 4096> const & {
+      static auto const table = [] {
+        auto table = std::array<uint32_t, 4096>{};
+        for (auto i = 0; i < 4096; ++i) {
+          auto const linear = (i + 0.5) / 4096;
+          auto const c = linear <= 0.0031308 ? linear * 12.92 : 1.055 * std::pow(linear, 1 / 2.4) - 0.055;
+          table[i] = static_cast<uint32_t>(std::lround(std::clamp(c, 0.0, 1.0) * 255));
+        }
+        for (auto x = 0; x < 256; ++x) {
+          table[toLinear()[x] >> 4] = static_cast<uint32_t>(x);
+        }
+        return table;
+      }();
+      return table;
+    }
+
+    inline auto mix(uint32_t a, uint32_t b, uint32_t weight) -> uint32_t {
+      return (a * (lerpOne - weight) + b * weight + lerpOne / 2) >> 15;
+    }
+
+    // Between two sRGB values in linear light, so fades don't dip through
+    // dark. Only for straight colour, lerp does premultiplied pixels.
+    inline auto mixLinear(uint32_t a, uint32_t b, uint32_t weight) -> uint8_t {
+      return static_cast<uint8_t>(fromLinear()[mix(toLinear()[a], toLinear()[b], weight) >> 4]);
+    }
+
+    // 255 / alpha in 8.8 fixed point, for 16 bit linear light. Times 65535
+    // it still fits in 32 bits unsigned.
+    inline auto unpremultiplyLinear() -> std::array<uint32_t, 256> const & {
+      static auto const table = [] {
+        auto table = std::array<uint32_t, 256>{};
+        for (uint32_t alpha = 1; alpha < 256; ++alpha) {
+          table[alpha] = ((255u << 8) + alpha / 2) / alpha;
+        }
+        return table;
+      }();
+      return table;
+    }
+
+    // The straight colour of a premultiplied value, as split has it
+    inline auto straight(uint32_t x, uint32_t scale) -> uint32_t {
+      return std::min<uint32_t>((x * scale + 0x8000) >> 16, 255);
+    }
+
+    // Linear light times alpha / 255, correctly rounded, so an alpha of 255
+    // leaves it as it is.
+    inline auto premultiplyLinear(uint32_t linear, uint32_t alpha) -> uint32_t {
+      auto const x = linear * alpha + 128;
+      return (x * 257 + (x >> 8)) >> 16;
+    }
+
+    // dst = a + (b - a) * weight / lerpOne for premultiplied pixels. The
+    // colour is divided by its alpha, taken to linear light and multiplied by
+    // the alpha again to be mixed, so a fade between different alphas is
+    // weighted by them, and is then divided by the mixed alpha to go back to
+    // sRGB, so it never comes out brighter than its alpha allows. Opaque
+    // pixels come out as mixLinear. dst can be a or b.
+    inline void lerp(uint8_t* dst, uint8_t const * a, uint8_t const * b, int pixels, uint32_t weight) {
+      auto const & scale = unpremultiply();
+      auto const & scaleLinear = unpremultiplyLinear();
+      auto const & linear = toLinear();
+      auto const & encode = fromLinear();
+      for (auto i = 0; i < pixels * 4; i += 4) {
+        uint32_t const alphaA = a[i + 3];
+        uint32_t const alphaB = b[i + 3];
+        auto const alpha = mix(alphaA, alphaB, weight);
+        for (auto c = 0; c < 3; ++c) {
+          auto const la = premultiplyLinear(linear[straight(a[i + c], scale[alphaA])], alphaA);
+          auto const lb = premultiplyLinear(linear[straight(b[i + c], scale[alphaB])], alphaB);
+          auto const l = std::min<uint32_t>((mix(la, lb, weight) * scaleLinear[alpha] + 0x80) >> 8, 0xFFFF);
+          dst[i + c] = static_cast<uint8_t>(div255(encode[l >> 4] * alpha));
+        }
+        dst[i + 3] = static_cast<uint8_t>(alpha);
+      }
+    }
+
+    inline auto legal(uint32_t x) -> uint32_t {
+      return 16 + div255(x * 219);
+    }
+
+    // The alpha is from srcKey, a grey key, if there is one, otherwise from
+    // src. Either of fill and key can be null.
+    inline void split(uint8_t const * src, uint8_t const * srcKey, uint8_t* fill, uint8_t* key, int pixels, Split options) {
+      auto const & scale = unpremultiply();
+      for (auto i = 0; i < pixels; ++i) {
+        uint32_t const alpha = srcKey ? srcKey[i * 4] : src[i * 4 + 3];
+        if (fill) {
+          for (auto c = 0; c < 3; ++c) {
+            uint32_t x = src[i * 4 + c];
+            if (options.straight) {
+              x = std::min<uint32_t>((x * scale[alpha] + 0x8000) >> 16, 255);
+            }
+            fill[i * 4 + c] = static_cast<uint8_t>(options.legal ? legal(x) : x);
+          }
+          fill[i * 4 + 3] = static_cast<uint8_t>(alpha);
+        }
+        if (key) {
+          auto const k = static_cast<uint8_t>(options.legal ? legal(alpha) : alpha);
+          if (options.key == Split::Key::Grey) {
+            key[i * 4 + 0] = k;
+            key[i * 4 + 1] = k;
+            key[i * 4 + 2] = k;
+            key[i * 4 + 3] = 255;
+          } else {
+            key[i] = k;
+          }
+        }
+      }
+    }
+  }
+
+#ifdef KERNELS_X86
+  // The same arithmetic as Scalar on 16 bit lanes, each pixel widened to 4
+  // lanes. 255 * 255 + 255 still fits.
+  namespace SSE41 {
+    KERNELS_TARGET("sse4.1")
+    inline auto div255(__m128i x) -> __m128i {
+      x = _mm_add_epi16(x, _mm_set1_epi16(128));
+      return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+    }
+
+    KERNELS_TARGET("sse4.1")
+    inline auto over(__m128i dst, __m128i src, __m128i opacity) -> __m128i {
+      auto const s = div255(_mm_mullo_epi16(src, opacity));
+      auto const alpha = _mm_shuffle_epi8(s, _mm_setr_epi8(6, 7, 6, 7, 6, 7, 6, 7, 14, 15, 14, 15, 14, 15, 14, 15));
+      return _mm_add_epi16(s, div255(_mm_mullo_epi16(dst, _mm_sub_epi16(_mm_set1_epi16(255), alpha))));
+    }
+
+    // 4 pixels
+    KERNELS_TARGET("sse4.1")
+    inline auto over(__m128i dst, __m128i src, uint32_t opacity) -> __m128i {
+      // Nothing is added and the destination is multiplied by 1
+      if (_mm_testz_si128(src, src)) {
+        return dst;
+      }
+      // Opaque, the destination is multiplied by 0
+      if (opacity == 255 && (_mm_movemask_epi8(_mm_cmpeq_epi8(src, _mm_set1_epi8(-1))) & 0x8888) == 0x8888) {
+        return src;
+      }
+      auto const zero = _mm_setzero_si128();
+      auto const o = _mm_set1_epi16(static_cast<short>(opacity));
+      // Saturating, as the clamp in Scalar
+      return _mm_packus_epi16
+        ( over(_mm_unpacklo_epi8(dst, zero), _mm_unpacklo_epi8(src, zero), o)
+        , over(_mm_unpackhi_epi8(dst, zero), _mm_unpackhi_epi8(src, zero), o)
+        );
+    }
+
+    KERNELS_TARGET("sse4.1")
+    inline void over(uint8_t* dst, uint8_t const * src, int pixels, uint32_t opacity) {
+      auto i = 0;
+      for (; i + 4 <= pixels; i += 4) {
+        auto const d = reinterpret_cast<__m128i*>(dst + i * 4);
+        _mm_storeu_si128(d, over(_mm_loadu_si128(d), _mm_loadu_si128(reinterpret_cast<__m128i const *>(src + i * 4)), opacity));
+      }
+      Scalar::over(dst + i * 4, src + i * 4, pixels - i, opacity);
+    }
+
+    KERNELS_TARGET("sse4.1")
+    inline void overScaled(uint8_t* dst, uint8_t const * srcRow, int pixels, uint32_t srcX, uint32_t step, uint32_t opacity) {
+      auto const row = reinterpret_cast<uint32_t const *>(srcRow);
+      auto i = 0;
+      for (; i + 4 <= pixels; i += 4, srcX += 4 * step) {
+        auto const s = _mm_setr_epi32
+          ( static_cast<int>(row[srcX >> 16])
+          , static_cast<int>(row[(srcX + step) >> 16])
+          , static_cast<int>(row[(srcX + 2 * step) >> 16])
+          , static_cast<int>(row[(srcX + 3 * step) >> 16])
+          );
+        auto const d = reinterpret_cast<__m128i*>(dst + i * 4);
+        _mm_storeu_si128(d, over(_mm_loadu_si128(d), s, opacity));
+      }
+      Scalar::overScaled(dst + i * 4, srcRow, pixels - i, srcX, step, opacity);
+    }
+
+    KERNELS_TARGET("sse4.1")
+    inline void keyFromAlpha(uint8_t* key, uint8_t const * fill, int pixels) {
+      auto const broadcast = _mm_setr_epi8(3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15);
+      auto const opaque = _mm_set1_epi32(static_cast<int>(0xFF000000));
+      auto i = 0;
+      for (; i + 4 <= pixels; i += 4) {
+        auto const f = _mm_loadu_si128(reinterpret_cast<__m128i const *>(fill + i * 4));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(key + i * 4), _mm_or_si128(_mm_shuffle_epi8(f, broadcast), opaque));
+      }
+      Scalar::keyFromAlpha(key + i * 4, fill + i * 4, pixels - i);
+    }
+
+    // Skips transparent blocks from each end, then finds the edges within them one pixel at a time
+    KERNELS_TARGET("sse4.1")
+    inline auto coverage(uint8_t const * src, int pixels) -> Coverage {
+      auto const alpha = _mm_set1_epi32(static_cast<int>(0xFF000000));
+      auto left = 0;
+      while (left + 4 <= pixels && _mm_testz_si128(_mm_loadu_si128(reinterpret_cast<__m128i const *>(src + left * 4)), alpha)) {
+        left += 4;
+      }
+      auto right = pixels;
+      while (right - 4 >= left && _mm_testz_si128(_mm_loadu_si128(reinterpret_cast<__m128i const *>(src + (right - 4) * 4)), alpha)) {
+        right -= 4;
+      }
+      while (left < right && src[left * 4 + 3] == 0) {
+        ++left;
+      }
+      if (left == right) {
+        return {};
+      }
+      while (src[(right - 1) * 4 + 3] == 0) {
+        --right;
+      }
+      auto opaque = left == 0 && right == pixels;
+      auto i = 0;
+      for (; opaque && i + 4 <= pixels; i += 4) {
+        opaque = _mm_testc_si128(_mm_loadu_si128(reinterpret_cast<__m128i const *>(src + i * 4)), alpha);
+      }
+      for (; opaque && i < pixels; ++i) {
+        opaque = src[i * 4 + 3] == 255;
+      }
+      return {left, right, opaque};
+    }
+
+    // Two lanes in each register
+    KERNELS_TARGET("sse4.1")
+    inline auto hash(uint8_t const * src, int bytes, uint64_t seed) -> uint64_t {
+      auto const secret = reinterpret_cast<__m128i const *>(hashSecret.data());
+      auto const seeds = _mm_set1_epi64x(static_cast<int64_t>(seed));
+      __m128i acc[2] = {_mm_xor_si128(seeds, _mm_loadu_si128(secret)), _mm_xor_si128(seeds, _mm_loadu_si128(secret + 1))};
+      auto const prime = _mm_set1_epi32(static_cast<int>(0x9E3779B1));
+      auto stripe = 0;
+      auto i = 0;
+      for (; i + hashStripe <= bytes; i += hashStripe) {
+        for (auto half = 0; half < 2; ++half) {
+          auto const data = _mm_loadu_si128(reinterpret_cast<__m128i const *>(src + i + half * 16));
+          auto const mixed = _mm_xor_si128(data, _mm_loadu_si128(reinterpret_cast<__m128i const *>(hashSecret.data() + stripe + half * 2)));
+          acc[half] = _mm_add_epi64(acc[half], _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2)));
+          acc[half] = _mm_add_epi64(acc[half], _mm_mul_epu32(mixed, _mm_srli_epi64(mixed, 32)));
+        }
+        if (++stripe == hashStripesPerBlock) {
+          for (auto half = 0; half < 2; ++half) {
+            auto a = _mm_xor_si128(acc[half], _mm_srli_epi64(acc[half], 47));
+            a = _mm_xor_si128(a, _mm_loadu_si128(secret + hashStripesPerBlock / 2 + 2 + half));
+            // 64 by 32 bit multiply
+            acc[half] = _mm_add_epi64(_mm_mul_epu32(a, prime), _mm_slli_epi64(_mm_mul_epu32(_mm_srli_epi64(a, 32), prime), 32));
+          }
+          stripe = 0;
+        }
+      }
+      uint64_t lanes[4];
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), acc[0]);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes + 2), acc[1]);
+      return Scalar::hashFinish(lanes, src + i, bytes - i, stripe, static_cast<uint64_t>(bytes));
+    }
+  }
+
+  // As SSE41 on 8 pixels. The unpacks and packs work within each 128 bit
+  // half so the pixels come back out in order.
+  namespace AVX2 {
+    KERNELS_TARGET("avx2")
+    inline auto div255(__m256i x) -> __m256i {
+      x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+      return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+    }
+
+    KERNELS_TARGET("avx2")
+    inline auto over(__m256i dst, __m256i src, __m256i opacity) -> __m256i {
+      auto const s = div255(_mm256_mullo_epi16(src, opacity));
+      auto const alpha = _mm256_shuffle_epi8(s, _mm256_setr_epi8
+        ( 6, 7, 6, 7, 6, 7, 6, 7, 14, 15, 14, 15, 14, 15, 14, 15
+        , 6, 7, 6, 7, 6, 7, 6, 7, 14, 15, 14, 15, 14, 15, 14, 15
+        ));
+      return _mm256_add_epi16(s, div255(_mm256_mullo_epi16(dst, _mm256_sub_epi16(_mm256_set1_epi16(255), alpha))));
+    }
+
+    KERNELS_TARGET("avx2")
+    inline auto over(__m256i dst, __m256i src, uint32_t opacity) -> __m256i {
+      if (_mm256_testz_si256(src, src)) {
+        return dst;
+      }
+      if (opacity == 255 && (static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(src, _mm256_set1_epi8(-1)))) & 0x88888888) == 0x88888888) {
+        return src;
+      }
+      auto const zero = _mm256_setzero_si256();
+      auto const o = _mm256_set1_epi16(static_cast<short>(opacity));
+      return _mm256_packus_epi16
+        ( over(_mm256_unpacklo_epi8(dst, zero), _mm256_unpacklo_epi8(src, zero), o)
+        , over(_mm256_unpackhi_epi8(dst, zero), _mm256_unpackhi_epi8(src, zero), o)
+        );
+    }
+
+    KERNELS_TARGET("avx2")
+    inline void over(uint8_t* dst, uint8_t const * src, int pixels, uint32_t opacity) {
+      auto i = 0;
+      for (; i + 8 <= pixels; i += 8) {
+        auto const d = reinterpret_cast<__m256i*>(dst + i * 4);
+        _mm256_storeu_si256(d, over(_mm256_loadu_si256(d), _mm256_loadu_si256(reinterpret_cast<__m256i const *>(src + i * 4)), opacity));
+      }
+      SSE41::over(dst + i * 4, src + i * 4, pixels - i, opacity);
+    }
+
+    KERNELS_TARGET("avx2")
+    inline void overScaled(uint8_t* dst, uint8_t const * srcRow, int pixels, uint32_t srcX, uint32_t step, uint32_t opacity) {
+      // The offsets wrap as the uint32_t in Scalar does
+      auto x = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(srcX)), _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(static_cast<int>(step))));
+      auto const advance = _mm256_set1_epi32(static_cast<int>(8 * step));
+      auto i = 0;
+      for (; i + 8 <= pixels; i += 8, srcX += 8 * step) {
+        auto const s = _mm256_i32gather_epi32(reinterpret_cast<int const *>(srcRow), _mm256_srli_epi32(x, 16), 4);
+        auto const d = reinterpret_cast<__m256i*>(dst + i * 4);
+        _mm256_storeu_si256(d, over(_mm256_loadu_si256(d), s, opacity));
+        x = _mm256_add_epi32(x, advance);
+      }
+      Scalar::overScaled(dst + i * 4, srcRow, pixels - i, srcX, step, opacity);
+    }
+
+    KERNELS_TARGET("avx2")
+    inline void keyFromAlpha(uint8_t* key, uint8_t const * fill, int pixels) {
+      auto const broadcast = _mm256_setr_epi8
+        ( 3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15
+        , 3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15
+        );
+      auto const opaque = _mm256_set1_epi32(static_cast<int>(0xFF000000));
+      auto i = 0;
+      for (; i + 8 <= pixels; i += 8) {
+        auto const f = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(fill + i * 4));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(key + i * 4), _mm256_or_si256(_mm256_shuffle_epi8(f, broadcast), opaque));
+      }
+      SSE41::keyFromAlpha(key + i * 4, fill + i * 4, pixels - i);
+    }
+
+    // On 32 bit lanes
+    KERNELS_TARGET("avx2")
+    inline auto legal(__m256i x) -> __m256i {
+      x = _mm256_add_epi32(_mm256_mullo_epi32(x, _mm256_set1_epi32(219)), _mm256_set1_epi32(128));
+      return _mm256_add_epi32(_mm256_set1_epi32(16), _mm256_srli_epi32(_mm256_add_epi32(x, _mm256_srli_epi32(x, 8)), 8));
+    }
+
+    // A pixel in each 32 bit lane
+    KERNELS_TARGET("avx2")
+    inline void split(uint8_t const * src, uint8_t const * srcKey, uint8_t* fill, uint8_t* key, int pixels, Split options) {
+      auto const scale = reinterpret_cast<int const *>(Scalar::unpremultiply().data());
+      auto const byte = _mm256_set1_epi32(0xFF);
+      auto i = 0;
+      for (; i + 8 <= pixels; i += 8) {
+        auto const p = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(src + i * 4));
+        auto const alpha = srcKey
+          ? _mm256_and_si256(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(srcKey + i * 4)), byte)
+          : _mm256_srli_epi32(p, 24);
+        if (fill) {
+          auto const s = options.straight ? _mm256_i32gather_epi32(scale, alpha, 4) : _mm256_setzero_si256();
+          auto out = _mm256_slli_epi32(alpha, 24);
+          for (auto c = 0; c < 3; ++c) {
+            auto const shift = _mm256_set1_epi32(8 * c);
+            auto x = _mm256_and_si256(_mm256_srlv_epi32(p, shift), byte);
+            if (options.straight) {
+              // Fits in 32 bits unsigned
+              x = _mm256_min_epu32(_mm256_srli_epi32(_mm256_add_epi32(_mm256_mullo_epi32(x, s), _mm256_set1_epi32(0x8000)), 16), byte);
+            }
+            if (options.legal) {
+              x = legal(x);
+            }
+            out = _mm256_or_si256(out, _mm256_sllv_epi32(x, shift));
+          }
+          _mm256_storeu_si256(reinterpret_cast<__m256i*>(fill + i * 4), out);
+        }
+        if (key) {
+          auto const k = options.legal ? legal(alpha) : alpha;
+          if (options.key == Split::Key::Grey) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(key + i * 4), _mm256_or_si256(_mm256_mullo_epi32(k, _mm256_set1_epi32(0x010101)), _mm256_set1_epi32(static_cast<int>(0xFF000000))));
+          } else {
+            // The low byte of each lane into the first 4 bytes of each half, then the halves together
+            auto const packed = _mm256_permutevar8x32_epi32
+              ( _mm256_shuffle_epi8(k, _mm256_set1_epi32(0x0C080400))
+              , _mm256_setr_epi32(0, 4, 1, 1, 1, 1, 1, 1)
+              );
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(key + i), _mm256_castsi256_si128(packed));
+          }
+        }
+      }
+      auto const keyBytes = options.key == Split::Key::Grey ? 4 : 1;
+      Scalar::split
+        ( src + i * 4
+        , srcKey ? srcKey + i * 4 : nullptr
+        , fill ? fill + i * 4 : nullptr
+        , key ? key + i * keyBytes : nullptr
+        , pixels - i
+        , options
+        );
+    }
+
+    // On 32 bit lanes
+    KERNELS_TARGET("avx2")
+    inline auto mix(__m256i a, __m256i b, uint32_t weight) -> __m256i {
+      auto const sum = _mm256_add_epi32
+        ( _mm256_mullo_epi32(a, _mm256_set1_epi32(static_cast<int>(lerpOne - weight)))
+        , _mm256_mullo_epi32(b, _mm256_set1_epi32(static_cast<int>(weight)))
+        );
+      return _mm256_srli_epi32(_mm256_add_epi32(sum, _mm256_set1_epi32(lerpOne / 2)), 15);
+    }
+
+    // Scalar::straight, x * scale fits in 32 bits unsigned
+    KERNELS_TARGET("avx2")
+    inline auto straight(__m256i x, __m256i scale) -> __m256i {
+      return _mm256_min_epu32(_mm256_srli_epi32(_mm256_add_epi32(_mm256_mullo_epi32(x, scale), _mm256_set1_epi32(0x8000)), 16), _mm256_set1_epi32(0xFF));
+    }
+
+    // Scalar::premultiplyLinear, the products fit in 32 bits unsigned
+    KERNELS_TARGET("avx2")
+    inline auto premultiplyLinear(__m256i linear, __m256i alpha) -> __m256i {
+      auto const x = _mm256_add_epi32(_mm256_mullo_epi32(linear, alpha), _mm256_set1_epi32(128));
+      return _mm256_srli_epi32(_mm256_add_epi32(_mm256_mullo_epi32(x, _mm256_set1_epi32(257)), _mm256_srli_epi32(x, 8)), 16);
+    }
+
+    // A pixel in each 32 bit lane, the tables gathered from Scalar's
+    KERNELS_TARGET("avx2")
+    inline void lerp(uint8_t* dst, uint8_t const * a, uint8_t const * b, int pixels, uint32_t weight) {
+      auto const scale = reinterpret_cast<int const *>(Scalar::unpremultiply().data());
+      auto const scaleLinear = reinterpret_cast<int const *>(Scalar::unpremultiplyLinear().data());
+      auto const linear = reinterpret_cast<int const *>(Scalar::toLinear().data());
+      auto const encode = reinterpret_cast<int const *>(Scalar::fromLinear().data());
+      auto const byte = _mm256_set1_epi32(0xFF);
+      auto i = 0;
+      for (; i + 8 <= pixels; i += 8) {
+        auto const pa = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(a + i * 4));
+        auto const pb = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(b + i * 4));
+        auto const alphaA = _mm256_srli_epi32(pa, 24);
+        auto const alphaB = _mm256_srli_epi32(pb, 24);
+        auto const alpha = mix(alphaA, alphaB, weight);
+        auto const scaleA = _mm256_i32gather_epi32(scale, alphaA, 4);
+        auto const scaleB = _mm256_i32gather_epi32(scale, alphaB, 4);
+        auto const scaleMixed = _mm256_i32gather_epi32(scaleLinear, alpha, 4);
+        auto out = _mm256_slli_epi32(alpha, 24);
+        for (auto c = 0; c < 3; ++c) {
+          auto const shift = _mm256_set1_epi32(8 * c);
+          auto const ca = straight(_mm256_and_si256(_mm256_srlv_epi32(pa, shift), byte), scaleA);
+          auto const cb = straight(_mm256_and_si256(_mm256_srlv_epi32(pb, shift), byte), scaleB);
+          auto const la = premultiplyLinear(_mm256_i32gather_epi32(linear, ca, 4), alphaA);
+          auto const lb = premultiplyLinear(_mm256_i32gather_epi32(linear, cb, 4), alphaB);
+          auto const l = _mm256_min_epu32
+            ( _mm256_srli_epi32(_mm256_add_epi32(_mm256_mullo_epi32(mix(la, lb, weight), scaleMixed), _mm256_set1_epi32(0x80)), 8)
+            , _mm256_set1_epi32(0xFFFF)
+            );
+          // Scalar::div255 on 32 bit lanes
+          auto x = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_i32gather_epi32(encode, _mm256_srli_epi32(l, 4), 4), alpha), _mm256_set1_epi32(128));
+          x = _mm256_srli_epi32(_mm256_add_epi32(x, _mm256_srli_epi32(x, 8)), 8);
+          out = _mm256_or_si256(out, _mm256_sllv_epi32(x, shift));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 4), out);
+      }
+      Scalar::lerp(dst + i * 4, a + i * 4, b + i * 4, pixels - i, weight);
+    }
+
+    KERNELS_TARGET("avx2")
+    inline auto coverage(uint8_t const * src, int pixels) -> Coverage {
+      auto const alpha = _mm256_set1_epi32(static_cast<int>(0xFF000000));
+      auto left = 0;
+      while (left + 8 <= pixels && _mm256_testz_si256(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(src + left * 4)), alpha)) {
+        left += 8;
+      }
+      auto right = pixels;
+      while (right - 8 >= left && _mm256_testz_si256(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(src + (right - 8) * 4)), alpha)) {
+        right -= 8;
+      }
+      while (left < right && src[left * 4 + 3] == 0) {
+        ++left;
+      }
+      if (left == right) {
+        return {};
+      }
+      while (src[(right - 1) * 4 + 3] == 0) {
+        --right;
+      }
+      auto opaque = left == 0 && right == pixels;
+      auto i = 0;
+      for (; opaque && i + 8 <= pixels; i += 8) {
+        opaque = _mm256_testc_si256(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(src + i * 4)), alpha);
+      }
+      for (; opaque && i < pixels; ++i) {
+        opaque = src[i * 4 + 3] == 255;
+      }
+      return {left, right, opaque};
+    }
+
+    KERNELS_TARGET("avx2")
+    inline auto hash(uint8_t const * src, int bytes, uint64_t seed) -> uint64_t {
+      auto const secret = hashSecret.data();
+      auto acc = _mm256_xor_si256(_mm256_set1_epi64x(static_cast<int64_t>(seed)), _mm256_loadu_si256(reinterpret_cast<__m256i const *>(secret)));
+      auto const prime = _mm256_set1_epi32(static_cast<int>(0x9E3779B1));
+      auto stripe = 0;
+      auto i = 0;
+      for (; i + hashStripe <= bytes; i += hashStripe) {
+        auto const data = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(src + i));
+        auto const mixed = _mm256_xor_si256(data, _mm256_loadu_si256(reinterpret_cast<__m256i const *>(secret + stripe)));
+        acc = _mm256_add_epi64(acc, _mm256_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2)));
+        acc = _mm256_add_epi64(acc, _mm256_mul_epu32(mixed, _mm256_srli_epi64(mixed, 32)));
+        if (++stripe == hashStripesPerBlock) {
+          auto a = _mm256_xor_si256(acc, _mm256_srli_epi64(acc, 47));
+          a = _mm256_xor_si256(a, _mm256_loadu_si256(reinterpret_cast<__m256i const *>(secret + hashStripesPerBlock + 4)));
+          acc = _mm256_add_epi64(_mm256_mul_epu32(a, prime), _mm256_slli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), prime), 32));
+          stripe = 0;
+        }
+      }
+      uint64_t lanes[4];
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc);
+      return Scalar::hashFinish(lanes, src + i, bytes - i, stripe, static_cast<uint64_t>(bytes));
+    }
+  }
+
+  // As AVX2 on 16 pixels, with masks for the pixels left over at the end.
+  // The shuffles are the same as AVX2's written as 32 bit words.
+  namespace AVX512 {
+    KERNELS_TARGET("avx512f,avx512bw")
+    inline auto div255(__m512i x) -> __m512i {
+      x = _mm512_add_epi16(x, _mm512_set1_epi16(128));
+      return _mm512_srli_epi16(_mm512_add_epi16(x, _mm512_srli_epi16(x, 8)), 8);
+    }
+
+    KERNELS_TARGET("avx512f,avx512bw")
+    inline auto over(__m512i dst, __m512i src, __m512i opacity) -> __m512i {
+      auto const s = div255(_mm512_mullo_epi16(src, opacity));
+      auto const alpha = _mm512_shuffle_epi8(s, _mm512_set4_epi32(0x0F0E0F0E, 0x0F0E0F0E, 0x07060706, 0x07060706));
+      return _mm512_add_epi16(s, div255(_mm512_mullo_epi16(dst, _mm512_sub_epi16(_mm512_set1_epi16(255), alpha))));
+    }
+
+    KERNELS_TARGET("avx512f,avx512bw")
+    inline auto over(__m512i dst, __m512i src, uint32_t opacity) -> __m512i {
+      if (_mm512_test_epi64_mask(src, src) == 0) {
+        return dst;
+      }
+      auto const alphas = __mmask64{0x8888888888888888};
+      if (opacity == 255 && (_mm512_cmpeq_epi8_mask(src, _mm512_set1_epi8(-1)) & alphas) == alphas) {
+        return src;
+      }
+      auto const zero = _mm512_setzero_si512();
+      auto const o = _mm512_set1_epi16(static_cast<short>(opacity));
+      return _mm512_packus_epi16
+        ( over(_mm512_unpacklo_epi8(dst, zero), _mm512_unpacklo_epi8(src, zero), o)
+        , over(_mm512_unpackhi_epi8(dst, zero), _mm512_unpackhi_epi8(src, zero), o)
+        );
+    }
+
+    // The first pixels of 16
+    KERNELS_TARGET("avx512f,avx512bw")
+    inline auto mask(int pixels) -> __mmask16 {
+      return static_cast<__mmask16>((1u << std::min(pixels, 16)) - 1);
+    }
+
+    // Every lane, for the 32 bit shifts and minimums. Those are masked to
+    // zero since GCC 12 warns that the undefined vector the unmasked ones
+    // start from may be used uninitialized.
+    constexpr auto all = __mmask16{0xFFFF};
+
+    KERNELS_TARGET("avx512f,avx512bw")
+    inline void over(uint8_t* dst, uint8_t const * src, int pixels, uint32_t opacity) {
+      for (auto i = 0; i < pixels; i += 16) {
+        auto const m = mask(pixels - i);
+        auto const d = _mm512_maskz_loadu_epi32(m, dst + i * 4);
+        auto const s = _mm512_maskz_loadu_epi32(m, src + i * 4);
+        _mm512_mask_storeu_epi32(dst + i * 4, m, over(d, s, opacity));
+      }
+    }
+
+    KERNELS_TARGET("avx512f,avx512bw")
+    inline void overScaled(uint8_t* dst, uint8_t const * srcRow, int pixels, uint32_t srcX, uint32_t step, uint32_t opacity) {
+      auto x = _mm512_add_epi32(_mm512_set1_epi32(static_cast<int>(srcX)), _mm512_mullo_epi32(_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15), _mm512_set1_epi32(static_cast<int>(step))));
+      auto const advance = _mm512_set1_epi32(static_cast<int>(16 * step));
+      for (auto i = 0; i < pixels; i += 16) {
+        auto const m = mask(pixels - i);
+        auto const s = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), m, _mm512_maskz_srli_epi32(m, x, 16), srcRow, 4);
+        auto const d = _mm512_maskz_loadu_epi32(m, dst + i * 4);
+        _mm512_mask_storeu_epi32(dst + i * 4, m, over(d, s, opacity));
+        x = _mm512_add_epi32(x, advance);
+      }
+    }
+
+    KERNELS_TARGET("avx512f,avx512bw")
+    inline void keyFromAlpha(uint8_t* key, uint8_t const * fill, int pixels) {
+      auto const broadcast = _mm512_set4_epi32(0x0F0F0F0F, 0x0B0B0B0B, 0x07070707, 0x03030303);
+      auto const opaque = _mm512_set1_epi32(static_cast<int>(0xFF000000));
+      for (auto i = 0; i < pixels; i += 16) {
+        auto const m = mask(pixels - i);
+        auto const f = _mm512_maskz_loadu_epi32(m, fill + i * 4);
+        _mm512_mask_storeu_epi32(key + i * 4, m, _mm512_or_si512(_mm512_shuffle_epi8(f, broadcast), opaque));
+      }
+    }
+
+    KERNELS_TARGET("avx512f,avx512bw")
+    inline auto mix(__m512i a, __m512i b, uint32_t weight) -> __m512i {
+      auto const sum = _mm512_add_epi32
+        ( _mm512_mullo_epi32(a, _mm512_set1_epi32(static_cast<int>(lerpOne - weight)))
+        , _mm512_mullo_epi32(b, _mm512_set1_epi32(static_cast<int>(weight)))
+        );
+      return _mm512_maskz_srli_epi32(all, _mm512_add_epi32(sum, _mm512_set1_epi32(lerpOne / 2)), 15);
+    }
+
+    KERNELS_TARGET("avx512f,avx512bw")
+    inline auto straight(__m512i x, __m512i scale) -> __m512i {
+      return _mm512_maskz_min_epu32(all, _mm512_maskz_srli_epi32(all, _mm512_add_epi32(_mm512_mullo_epi32(x, scale), _mm512_set1_epi32(0x8000)), 16), _mm512_set1_epi32(0xFF));
+    }
+
+    KERNELS_TARGET("avx512f,avx512bw")
+    inline auto premultiplyLinear(__m512i linear, __m512i alpha) -> __m512i {
+      auto const x = _mm512_add_epi32(_mm512_mullo_epi32(linear, alpha), _mm512_set1_epi32(128));
+      return _mm512_maskz_srli_epi32(all, _mm512_add_epi32(_mm512_mullo_epi32(x, _mm512_set1_epi32(257)), _mm512_maskz_srli_epi32(all, x, 8)), 16);
+    }
+
+    KERNELS_TARGET("avx512f,avx512bw")
+    inline void lerp(uint8_t* dst, uint8_t const * a, uint8_t const * b, int pixels, uint32_t weight) {
+      auto const scale = Scalar::unpremultiply().data();
+      auto const scaleLinear = Scalar::unpremultiplyLinear().data();
+      auto const linear = Scalar::toLinear().data();
+      auto const encode = Scalar::fromLinear().data();
+      auto const byte = _mm512_set1_epi32(0xFF);
+      auto const zero = _mm512_setzero_si512();
+      for (auto i = 0; i < pixels; i += 16) {
+        auto const m = mask(pixels - i);
+        auto const pa = _mm512_maskz_loadu_epi32(m, a + i * 4);
+        auto const pb = _mm512_maskz_loadu_epi32(m, b + i * 4);
+        auto const alphaA = _mm512_maskz_srli_epi32(all, pa, 24);
+        auto const alphaB = _mm512_maskz_srli_epi32(all, pb, 24);
+        auto const alpha = mix(alphaA, alphaB, weight);
+        auto const scaleA = _mm512_mask_i32gather_epi32(zero, m, alphaA, scale, 4);
+        auto const scaleB = _mm512_mask_i32gather_epi32(zero, m, alphaB, scale, 4);
+        auto const scaleMixed = _mm512_mask_i32gather_epi32(zero, m, alpha, scaleLinear, 4);
+        auto out = _mm512_maskz_slli_epi32(all, alpha, 24);
+        for (auto c = 0u; c < 3; ++c) {
+          auto const ca = straight(_mm512_and_si512(_mm512_maskz_srli_epi32(all, pa, 8 * c), byte), scaleA);
+          auto const cb = straight(_mm512_and_si512(_mm512_maskz_srli_epi32(all, pb, 8 * c), byte), scaleB);
+          auto const la = premultiplyLinear(_mm512_mask_i32gather_epi32(zero, m, ca, linear, 4), alphaA);
+          auto const lb = premultiplyLinear(_mm512_mask_i32gather_epi32(zero, m, cb, linear, 4), alphaB);
+          auto const l = _mm512_maskz_min_epu32
+            ( all
+            , _mm512_maskz_srli_epi32(all, _mm512_add_epi32(_mm512_mullo_epi32(mix(la, lb, weight), scaleMixed), _mm512_set1_epi32(0x80)), 8)
+            , _mm512_set1_epi32(0xFFFF)
+            );
+          auto x = _mm512_add_epi32(_mm512_mullo_epi32(_mm512_mask_i32gather_epi32(zero, m, _mm512_maskz_srli_epi32(all, l, 4), encode, 4), alpha), _mm512_set1_epi32(128));
+          x = _mm512_maskz_srli_epi32(all, _mm512_add_epi32(x, _mm512_maskz_srli_epi32(all, x, 8)), 8);
+          out = _mm512_or_si512(out, _mm512_maskz_slli_epi32(all, x, 8 * c));
+        }
+        _mm512_mask_storeu_epi32(dst + i * 4, m, out);
+      }
+    }
+  }
+#endif
+
+  // The best this CPU and OS support
+  inline auto detect() -> Level {
+#if defined(KERNELS_X86) && !defined(_MSC_VER)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512bw")) {
+      return Level::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+      return Level::AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+      return Level::SSE41;
+    }
+    return Level::Scalar;
+#elif defined(KERNELS_X86)
+    int info[4];
+    __cpuid(info, 0);
+    auto const leaves = info[0];
+    __cpuid(info, 1);
+    auto const sse41 = (info[2] & (1 << 19)) != 0;
+    // The OS has to save the wider registers too
+    auto const osxsave = (info[2] & (1 << 27)) != 0;
+    auto const xcr0 = osxsave ? _xgetbv(0) : 0;
+    auto extended = 0;
+    if (leaves >= 7) {
+      __cpuidex(info, 7, 0);
+      extended = info[1];
+    }
+    if ((extended & (1 << 16)) && (extended & (1 << 30)) && (xcr0 & 0xE6) == 0xE6) {
+      return Level::AVX512;
+    }
+    if ((extended & (1 << 5)) && (xcr0 & 0x6) == 0x6) {
+      return Level::AVX2;
+    }
+    return sse41 ? Level::SSE41 : Level::Scalar;
+#else
+    return Level::Scalar;
+#endif
+  }
+
+  inline auto levelName(Level level) -> char const * {
+    switch (level) {
+      case Level::Scalar:
+        return "scalar";
+      case Level::SSE41:
+        return "sse4.1";
+      case Level::AVX2:
+        return "avx2";
+      case Level::AVX512:
+        return "avx512";
+    }
+    return "scalar";
+  }
+
+  struct Implementation {
+    Level level;
+    void (*over)(uint8_t* dst, uint8_t const * src, int pixels, uint32_t opacity);
+    void (*overScaled)(uint8_t* dst, uint8_t const * srcRow, int pixels, uint32_t srcX, uint32_t step, uint32_t opacity);
+    void (*keyFromAlpha)(uint8_t* key, uint8_t const * fill, int pixels);
+    void (*split)(uint8_t const * src, uint8_t const * srcKey, uint8_t* fill, uint8_t* key, int pixels, Split options);
+    Coverage (*coverage)(uint8_t const * src, int pixels);
+    uint64_t (*hash)(uint8_t const * src, int bytes, uint64_t seed);
+    void (*lerp)(uint8_t* dst, uint8_t const * a, uint8_t const * b, int pixels, uint32_t weight);
+  };
+
+  inline auto implementation(Level level) -> Implementation {
+    switch (level) {
+#ifdef KERNELS_X86
+      case Level::AVX512:
+        return {level, AVX512::over, AVX512::overScaled, AVX512::keyFromAlpha, AVX2::split, AVX2::coverage, AVX2::hash, AVX512::lerp};
+      case Level::AVX2:
+        return {level, AVX2::over, AVX2::overScaled, AVX2::keyFromAlpha, AVX2::split, AVX2::coverage, AVX2::hash, AVX2::lerp};
+      // Without a gather split and lerp aren't worth it
+      case Level::SSE41:
+        return {level, SSE41::over, SSE41::overScaled, SSE41::keyFromAlpha, Scalar::split, SSE41::coverage, SSE41::hash, Scalar::lerp};
+#endif
+      default:
+        return {Level::Scalar, Scalar::over, Scalar::overScaled, Scalar::keyFromAlpha, Scalar::split, Scalar::coverage, Scalar::hash, Scalar::lerp};
+    }
+  }
+
+  inline auto current() -> Implementation & {
+    static auto current = implementation(detect());
+    return current;
+  }
+
+  // Uses at most this level, for comparing them. Not thread safe, call it
+  // before compositing starts.
+  inline void limit(Level level) {
+    current() = implementation(std::min(level, detect()));
+  }
+
+  inline void over(uint8_t* dst, uint8_t const * src, int pixels, uint32_t opacity) {
+    current().over(dst, src, pixels, opacity);
+  }
+
+  inline void overScaled(uint8_t* dst, uint8_t const * srcRow, int pixels, uint32_t srcX, uint32_t step, uint32_t opacity) {
+    current().overScaled(dst, srcRow, pixels, srcX, step, opacity);
+  }
+
+  inline void keyFromAlpha(uint8_t* key, uint8_t const * fill, int pixels) {
+    current().keyFromAlpha(key, fill, pixels);
+  }
+
+  inline void split(uint8_t const * src, uint8_t const * srcKey, uint8_t* fill, uint8_t* key, int pixels, Split options) {
+    current().split(src, srcKey, fill, key, pixels, options);
+  }
+
+  inline auto coverage(uint8_t const * src, int pixels) -> Coverage {
+    return current().coverage(src, pixels);
+  }
+
+  inline auto hash(uint8_t const * src, int bytes, uint64_t seed = 0) -> uint64_t {
+    return current().hash(src, bytes, seed);
+  }
+
+  // t from 0 to 1 as a weight for lerp
+  inline auto lerpWeight(double t) -> uint32_t {
+    return static_cast<uint32_t>(std::lround(std::clamp(t, 0.0, 1.0) * lerpOne));
+  }
+
+  inline void lerp(uint8_t* dst, uint8_t const * a, uint8_t const * b, int pixels, uint32_t weight) {
+    current().lerp(dst, a, b, pixels, weight);
+  }
+}
+
+#endif
@@ -1,93 +1,754 @@
 #ifndef KeyFill_hpp
 #define KeyFill_hpp
 
+#include <algorithm>
+#include <bitset>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
 #include <string>
+#include <utility>
 #include <vector>
 
+#include <fmt/core.h>
+
+#include "Kernels.hpp"
 #include "Light2D.hpp"
+#include "ThreadPool.hpp"
 
 namespace KeyFill {
+  // Each output is a 1920x1080 half of the window, fill on the left, key on the right
+  constexpr auto outputSize = L2D::Size{1920, 1080};
+
+  // In the coordinates of one output
+  struct LayerProperties {
+    int z = 0;
+    bool visible = true;
+    float opacity = 1;
+    // The whole output if not set
+    std::optional<L2D::Rect> dst;
+    // The whole source if not set
+    std::optional<L2D::Rect> crop;
+  };
+
+  enum class Easing { Linear, EaseIn, EaseOut, EaseInOut };
+
+  inline auto ease(Easing easing, float t) -> float {
+    switch (easing) {
+      case Easing::Linear:
+        return t;
+      case Easing::EaseIn:
+        return t * t;
+      case Easing::EaseOut:
+        return 1 - (1 - t) * (1 - t);
+      case Easing::EaseInOut:
+        return t * t * (3 - 2 * t);
+    }
+    return t;
+  }
+
+  // How a change in visibility is shown. A mix between two layers is a
+  // transition on each, started in the same frame.
+  struct Transition {
+    enum class Kind
+      // Straight to the new visibility in the next frame
+      { Cut
+      // Fades the opacity in or out
+      , Mix
+      // Reveals or removes it behind an edge moving left to right
+      , Wipe
+      };
+
+    Kind kind = Kind::Cut;
+    int frames = 0;
+    Easing easing = Easing::Linear;
+  };
+
+  // A presented frame as it was in the window, BGRA with the fill on the left
+  // and the key on the right. Only valid for the duration of the call.
+  struct Frame {
+    uint64_t number;
+    L2D::Size size;
+    uint8_t const * pixels;
+    int pitch;
+  };
+
+  using Sink = std::function<void(Frame const &)>;
+
+  // Composites on the CPU into memory with no window, the frames only go to the sinks
+  struct Offscreen {};
+
+  // Composites on the CPU and shows the result in the window, for machines without a GPU
+  struct CPU {};
+
+  // A layer's pixels for its source to write to, BGRA premultiplied, locked until this is destroyed
+  struct Buffer {
+    std::unique_ptr<void, std::function<void(void*)>> pixels;
+    int pitch;
+  };
+
+  // The tiles of the output that changed since the last frame. Each row of
+  // tiles is composited on one thread at a time, few enough rows that fill and
+  // key stay in the cache.
+  class Damage {
+    public:
+      static constexpr auto tileSize = L2D::Size{64, 16};
+      static constexpr auto columns = (outputSize.w + tileSize.w - 1) / tileSize.w;
+      static constexpr auto rows = (outputSize.h + tileSize.h - 1) / tileSize.h;
+
+    private:
+      // Everything until the first frame
+      std::bitset<columns * rows> tiles = std::bitset<columns * rows>{}.set();
+
+    public:
+      // In the output, anything outside it is ignored
+      void add(L2D::Rect rect) {
+        rect = rect & L2D::Rect{{0, 0}, outputSize};
+        if (rect.empty()) {
+          return;
+        }
+        for (auto row = rect.top() / tileSize.h; row <= (rect.bottom() - 1) / tileSize.h; ++row) {
+          for (auto column = rect.left() / tileSize.w; column <= (rect.right() - 1) / tileSize.w; ++column) {
+            tiles.set(row * columns + column);
+          }
+        }
+      }
+
+      void all() { tiles.set(); }
+      void clear() { tiles.reset(); }
+
+      auto any() const { return tiles.any(); }
+
+      auto test(int column, int row) const { return tiles.test(row * columns + column); }
+
+      // Around all the damaged tiles, empty if there are none
+      auto bounds() const -> L2D::Rect {
+        auto result = L2D::Rect{0, 0, 0, 0};
+        for (auto row = 0; row < rows; ++row) {
+          for (auto column = 0; column < columns; ++column) {
+            if (test(column, row)) {
+              auto const tile = L2D::Rect{{column * tileSize.w, row * tileSize.h}, tileSize};
+              result = result.empty() ? tile : result | tile;
+            }
+          }
+        }
+        return result & L2D::Rect{{0, 0}, outputSize};
+      }
+  };
+
   class Windows {
     private:
-      struct Texture {
-        bool shown;
-        L2D::StreamingTexture texture;
-
-        Texture(L2D::Renderer& renderer)
-          : shown{false}
-          , texture{renderer, L2D::Surface::Format::BGRA32, {1920, 1080}}
-          {}
+      struct Placement {
+        Uint8 alpha;
+        // In the source
+        L2D::Rect src;
+        // In the output
+        L2D::Rect dst;
+        L2D::Rect clip;
+
+        friend auto operator==(Placement const & lhs, Placement const & rhs) {
+          return
+            (  lhs.alpha == rhs.alpha
+            && lhs.src == rhs.src
+            && lhs.dst == rhs.dst
+            && lhs.clip == rhs.clip
+            );
+        }
+        friend auto operator!=(Placement const & lhs, Placement const & rhs) { return !(lhs == rhs); }
+      };
+
+      struct Layer {
+        std::string name;
+        // Breaks ties in z so layers added later go on top
+        size_t order;
+        LayerProperties properties;
+        // Cleared when the source stops, so an empty layer isn't drawn
+        bool hasContent;
+        L2D::Size size;
+        // On the GPU in a window, in memory when compositing on the CPU
+        std::optional<L2D::StreamingTexture> texture;
+        L2D::FramePool::Frame pixels;
+
+        struct Animation {
+          Transition transition;
+          // How visible the layer is from 0 to 1, picked up from wherever an interrupted transition had got to
+          float from;
+          float to;
+          uint64_t firstFrame;
+
+          auto lastFrame() const { return firstFrame + transition.frames - 1; }
+        };
+        // Runs while visible already has its new value
+        std::optional<Animation> animation;
+
+        // In the source, written since the last frame
+        std::vector<L2D::Rect> dirty;
+        // Its z changed since the last frame
+        bool restacked = false;
+        // Where it was in the last frame
+        std::optional<Placement> shown;
+
+        // What isn't transparent in each row of the source and around all of
+        // them, only scanned for when the layer is in memory, otherwise all
+        // of it with no opaque rows
+        std::vector<Kernels::Coverage> coverage;
+        L2D::Rect bounds;
+
+        Layer(L2D::Renderer* renderer, std::string name, size_t order, LayerProperties properties, L2D::Size size)
+          : name{std::move(name)}
+          , order{order}
+          , properties{properties}
+          , hasContent{false}
+          , size{size}
+          , bounds{0, 0, 0, 0}
+          {
+          if (renderer) {
+            texture.emplace(*renderer, L2D::Surface::Format::BGRA32, size);
+            coverage.resize(size.h, {0, size.w, false});
+            bounds = {{0, 0}, size};
+          } else {
+            // Nothing has been written to it yet
+            pixels = L2D::FramePool::shared().acquire(size.w * size.h * 4);
+            std::memset(pixels.data(), 0, pixels.size());
+            coverage.resize(size.h);
+          }
+        }
+
+        auto drawn() const {
+          return hasContent && (properties.visible || animation) && properties.opacity > 0;
+        }
+
+        auto visibility(uint64_t frame) const -> float {
+          if (!animation) {
+            return properties.visible ? 1 : 0;
+          }
+          if (frame < animation->firstFrame) {
+            return animation->from;
+          }
+          auto const t = std::min(static_cast<float>(frame - animation->firstFrame + 1) / animation->transition.frames, 1.0f);
+          return lerp(animation->from, animation->to, ease(animation->transition.easing, t));
+        }
       };
 
-      L2D::Window window;
-      L2D::Renderer renderer;
-      std::vector<Texture> textures;
+      // Neither when offscreen
+      std::optional<L2D::Window> window;
+      std::optional<L2D::Renderer> renderer;
+      // The frame composited on the CPU, to show in the window
+      std::optional<L2D::StreamingTexture> output;
+      // Node based so the pointers in stack stay valid
+      std::map<std::string, Layer> layers;
+      // Bottom to top, only sorted again when a layer is added or its z changes
+      std::vector<Layer*> stack;
+      bool restack = false;
+      size_t nextOrder = 0;
+
+      // Frames presented so far
+      uint64_t frame = 0;
+      std::vector<std::function<void(uint64_t)>> onPresented;
+
+      std::map<std::string, Sink> sinks;
+      // The window is only read back while there are sinks, on the CPU this is the frame
+      L2D::FramePool::Frame readback;
+      // Nothing is drawn again until something changes, the last frame stays
+      // in the window and in readback
+      Damage damage;
+
+      static constexpr auto frameSize = L2D::Size{outputSize.w * 2, outputSize.h};
+      static constexpr auto framePitch = frameSize.w * 4;
+
+      auto gpu() const { return renderer && !output; }
+
+      void allocateReadback() {
+        if (!readback) {
+          readback = L2D::FramePool::shared().acquire(framePitch * frameSize.h);
+        }
+      }
+
+      // Adds it on top if it doesn't exist yet
+      auto findOrAdd(std::string const & name) -> Layer& {
+        if (!layers.count(name)) {
+          addLayer(name, {topZ()});
+        }
+        return layers.at(name);
+      }
+
+      auto lock(Layer& layer) -> Buffer {
+        layer.hasContent = true;
+        if (layer.texture) {
+          auto locked = layer.texture->lock();
+          auto unlocker = locked.pixels.get_deleter();
+          return {{locked.pixels.release(), unlocker}, locked.pitch};
+        } else {
+          return {{layer.pixels.data(), [](void*) {}}, layer.size.w * 4};
+        }
+      }
+
+      auto sorted() -> std::vector<Layer*> const & {
+        if (restack) {
+          std::sort
+            ( stack.begin()
+            , stack.end()
+            , [](auto lhs, auto rhs) {
+              return std::pair{lhs->properties.z, lhs->order} < std::pair{rhs->properties.z, rhs->order};
+            });
+          restack = false;
+        }
+        return stack;
+      }
+
+      // Where and how the layer is drawn in the next frame to be presented, if at all
+      auto placement(Layer const & layer) const -> std::optional<Placement> {
+        if (!layer.drawn()) {
+          return std::nullopt;
+        }
+        auto const & properties = layer.properties;
+        auto const visibility = layer.visibility(frame + 1);
+        auto const wipe = layer.animation && layer.animation->transition.kind == Transition::Kind::Wipe;
+        auto opacity = std::clamp(properties.opacity, 0.0f, 1.0f);
+        if (!wipe) {
+          opacity *= visibility;
+        }
+        // The content is premultiplied so the colour has to be scaled as well as the alpha
+        auto const alpha = static_cast<Uint8>(std::lround(opacity * 255));
+        if (alpha == 0 || visibility <= 0) {
+          return std::nullopt;
+        }
+
+        auto const whole = L2D::Rect{{0, 0}, layer.size};
+        auto const src = properties.crop ? *properties.crop & whole : whole;
+        auto const dst = properties.dst.value_or(L2D::Rect{{0, 0}, outputSize});
+        auto clip = dst & L2D::Rect{{0, 0}, outputSize};
+        if (wipe) {
+          auto const shown = static_cast<int>(std::lround(dst.w * visibility));
+          clip = clip & L2D::Rect
+            { layer.animation->to > layer.animation->from ? dst.x : dst.right() - shown
+            , dst.y
+            , shown
+            , dst.h
+            };
+        }
+        if (src.empty() || clip.empty()) {
+          return std::nullopt;
+        }
+        return Placement{alpha, src, dst, clip};
+      }
+
+      static auto scale(int value, int from, int to) {
+        return static_cast<int>(static_cast<int64_t>(value) * to / from);
+      }
+
+      // Where a rect in the source ends up in the output, a pixel bigger all
+      // round to cover rounding when it is scaled. Empty if rect is.
+      static auto toOutput(Placement const & placement, L2D::Rect rect) -> L2D::Rect {
+        if (rect.empty()) {
+          return rect;
+        }
+        auto const & [alpha, src, dst, clip] = placement;
+        auto const left = dst.x + scale(rect.left() - src.x, src.w, dst.w) - 1;
+        auto const right = dst.x + scale(rect.right() - src.x, src.w, dst.w) + 1;
+        auto const top = dst.y + scale(rect.top() - src.y, src.h, dst.h) - 1;
+        auto const bottom = dst.y + scale(rect.bottom() - src.y, src.h, dst.h) + 1;
+        return L2D::Rect{left, top, right - left, bottom - top} & clip;
+      }
+
+      // Finds what isn't transparent again in the rows the source wrote to,
+      // a few rows at a time across the thread pool
+      static void scan(Layer& layer) {
+        if (layer.texture || layer.dirty.empty()) {
+          return;
+        }
+        auto rows = std::vector<bool>(layer.size.h);
+        for (auto const & rect : layer.dirty) {
+          for (auto y = std::max(rect.top(), 0); y < std::min(rect.bottom(), layer.size.h); ++y) {
+            rows[y] = true;
+          }
+        }
+        auto const blocks = static_cast<size_t>((layer.size.h + Damage::tileSize.h - 1) / Damage::tileSize.h);
+        ThreadPool::ThreadPool::shared().forEach(blocks, [&layer, &rows](size_t block) {
+          auto const top = static_cast<int>(block) * Damage::tileSize.h;
+          for (auto y = top; y < std::min(top + Damage::tileSize.h, layer.size.h); ++y) {
+            if (rows[y]) {
+              layer.coverage[y] = Kernels::coverage(layer.pixels.data() + y * layer.size.w * 4, layer.size.w);
+            }
+          }
+        });
+
+        auto left = layer.size.w;
+        auto right = 0;
+        auto top = layer.size.h;
+        auto bottom = 0;
+        for (auto y = 0; y < layer.size.h; ++y) {
+          auto const & row = layer.coverage[y];
+          if (row.left < row.right) {
+            left = std::min(left, row.left);
+            right = std::max(right, row.right);
+            top = std::min(top, y);
+            bottom = y + 1;
+          }
+        }
+        layer.bounds = top < bottom ? L2D::Rect{left, top, right - left, bottom - top} : L2D::Rect{0, 0, 0, 0};
+      }
+
+      // Both where a layer was and where it will be if it moved, faded, was
+      // restacked or was shown or hidden, otherwise just what its source
+      // wrote where it wasn't transparent before or after
+      void collectDamage() {
+        for (auto layer : stack) {
+          auto const before = layer->bounds;
+          scan(*layer);
+          auto const placement = this->placement(*layer);
+          if (placement != layer->shown || layer->restacked) {
+            if (layer->shown) {
+              damage.add(toOutput(*layer->shown, before));
+            }
+            if (placement) {
+              damage.add(toOutput(*placement, layer->bounds));
+            }
+          } else if (placement) {
+            for (auto const & rect : layer->dirty) {
+              damage.add(toOutput(*placement, rect & before));
+              damage.add(toOutput(*placement, rect & layer->bounds));
+            }
+          }
+          layer->dirty.clear();
+          layer->restacked = false;
+          layer->shown = placement;
+        }
+      }
+
+      void draw(L2D::Point origin) {
+        for (auto layer : stack) {
+          auto const placement = this->placement(*layer);
+          if (!placement) {
+            continue;
+          }
+          renderer->clip(placement->clip + origin);
+          layer->texture->setAlphaMod(placement->alpha);
+          layer->texture->setColourMod({placement->alpha, placement->alpha, placement->alpha});
+          layer->texture->render(placement->src, placement->dst + origin, L2D::BlendMode::PremultipliedOver());
+        }
+        renderer->unclip();
+      }
+
+      // The row of the source shown in row y of the output
+      static auto sourceRow(Placement const & placement, int y) {
+        auto const & [alpha, src, dst, clip] = placement;
+        return src.y + (y - dst.y) * src.h / dst.h;
+      }
+
+      // The same as draw and the key fill, into readback, only in the damaged
+      // tiles, a row of tiles at a time across the thread pool. Only the parts
+      // of each row that aren't transparent are blended, starting from the
+      // top layer that is opaque across the whole of the tile.
+      void composite() {
+        allocateReadback();
+
+        auto placements = std::vector<std::pair<Layer const *, Placement>>{};
+        for (auto layer : stack) {
+          if (auto const placement = this->placement(*layer)) {
+            placements.emplace_back(layer, *placement);
+          }
+        }
+
+        ThreadPool::ThreadPool::shared().forEach(Damage::rows, [this, &placements](size_t tileRow) {
+          auto const row = static_cast<int>(tileRow);
+          auto const top = row * Damage::tileSize.h;
+          auto const bottom = std::min(top + Damage::tileSize.h, outputSize.h);
+
+          // Left and right of each run of damaged tiles
+          auto spans = std::vector<std::pair<int, int>>{};
+          for (auto column = 0; column < Damage::columns; ++column) {
+            if (!damage.test(column, row)) {
+              continue;
+            }
+            auto const left = column * Damage::tileSize.w;
+            auto const right = std::min(left + Damage::tileSize.w, outputSize.w);
+            if (!spans.empty() && spans.back().second == left) {
+              spans.back().second = right;
+            } else {
+              spans.emplace_back(left, right);
+            }
+          }
+          if (spans.empty()) {
+            return;
+          }
+
+          for (auto y = top; y < bottom; ++y) {
+            auto const dstRow = readback.data() + y * framePitch;
+            for (auto [left, right] : spans) {
+              auto hides = [y, left = left, right = right](auto const & layerPlacement) {
+                auto const & [layer, placement] = layerPlacement;
+                auto const & clip = placement.clip;
+                return placement.alpha == 255
+                  && y >= clip.y && y < clip.bottom()
+                  && left >= clip.x && right <= clip.right()
+                  && layer->coverage[sourceRow(placement, y)].opaque;
+              };
+              auto const hidden = std::find_if(placements.rbegin(), placements.rend(), hides);
+              if (hidden == placements.rend()) {
+                std::memset(dstRow + left * 4, 0, (right - left) * 4);
+              }
+
+              for (auto it = hidden == placements.rend() ? placements.begin() : std::prev(hidden.base()); it != placements.end(); ++it) {
+                auto const & [layer, placement] = *it;
+                auto const & [alpha, src, dst, clip] = placement;
+                if (y < clip.y || y >= clip.bottom()) {
+                  continue;
+                }
+                auto const srcY = sourceRow(placement, y);
+                auto const & coverage = layer->coverage[srcY];
+                auto const from = std::max({left, clip.x, dst.x + scale(coverage.left - src.x, src.w, dst.w) - 1});
+                auto const to = std::min({right, clip.right(), dst.x + scale(coverage.right - src.x, src.w, dst.w) + 1});
+                if (coverage.left >= coverage.right || from >= to) {
+                  continue;
+                }
+                auto const srcRow = layer->pixels.data() + srcY * layer->size.w * 4;
+                if (src.w == dst.w) {
+                  Kernels::over(dstRow + from * 4, srcRow + (src.x + from - dst.x) * 4, to - from, alpha);
+                } else {
+                  // 16.16 fixed point
+                  auto const step = static_cast<uint32_t>((static_cast<uint64_t>(src.w) << 16) / dst.w);
+                  Kernels::overScaled(dstRow + from * 4, srcRow, to - from, (static_cast<uint32_t>(src.x) << 16) + (from - dst.x) * step, step, alpha);
+                }
+              }
+            }
+          }
+
+          for (auto y = top; y < bottom; ++y) {
+            auto const fill = readback.data() + y * framePitch;
+            for (auto [left, right] : spans) {
+              Kernels::keyFromAlpha(fill + (outputSize.w + left) * 4, fill + left * 4, right - left);
+            }
+          }
+        });
+      }
 
     public:
-      Windows(L2D::L2DInit& l2DInit, std::string title, L2D::Rect rect, int flags)
-        : window{l2DInit, title, rect, flags}
-        , renderer{window}
-        {}
+      // Composites on the CPU anyway if SDL could only make a software renderer
+      Windows(L2D::L2DInit& l2DInit, std::string title, L2D::Rect rect, int flags) {
+        window.emplace(l2DInit, title, rect, flags);
+        renderer.emplace(*window);
+        if (renderer->software()) {
+          output.emplace(*renderer, L2D::Surface::Format::BGRA32, frameSize);
+        }
+      }
 
-      auto lock(size_t i) {
-        while (textures.size() <= i) {
-          textures.emplace_back(renderer);
+      Windows(CPU, L2D::L2DInit& l2DInit, std::string title, L2D::Rect rect, int flags) {
+        window.emplace(l2DInit, title, rect, flags);
+        renderer.emplace(*window);
+        output.emplace(*renderer, L2D::Surface::Format::BGRA32, frameSize);
+      }
+
+      Windows(Offscreen) {}
+
+      auto offscreen() const { return !renderer; }
+
+      auto compositesOnCPU() const { return !gpu(); }
+
+      // Puts a new layer on top
+      auto topZ() -> int {
+        auto const & bottomToTop = sorted();
+        return bottomToTop.empty() ? 0 : bottomToTop.back()->properties.z + 1;
+      }
+
+      // Returns false if there is already a layer with this name
+      auto addLayer(std::string const & name, LayerProperties properties = {}, L2D::Size size = outputSize) -> bool {
+        auto [it, inserted] = layers.try_emplace(name, gpu() ? &*renderer : nullptr, name, nextOrder, properties, size);
+        if (inserted) {
+          nextOrder += 1;
+          stack.push_back(&it->second);
+          restack = true;
         }
-        textures[i].shown = true;
-        return textures[i].texture.lock();
+        return inserted;
       }
 
-      auto hide(size_t i) {
-        if (textures.size() > i) {
-          textures[i].shown = false;
+      auto removeLayer(std::string const & name) -> bool {
+        auto it = layers.find(name);
+        if (it == layers.end()) {
+          return false;
+        }
+        if (auto const & shown = it->second.shown) {
+          damage.add(shown->clip);
         }
+        stack.erase(std::find(stack.begin(), stack.end(), &it->second));
+        layers.erase(it);
+        return true;
       }
 
+      auto layer(std::string const & name) const -> std::optional<LayerProperties> {
+        auto it = layers.find(name);
+        if (it == layers.end()) {
+          return std::nullopt;
+        }
+        return it->second.properties;
+      }
+
+      // Whether it is drawn at all, hidden layers are while they transition out
+      auto drawn(std::string const & name) const -> bool {
+        auto it = layers.find(name);
+        return it != layers.end() && it->second.drawn();
+      }
+
+      // A change in visibility is shown with the transition, starting in the next frame
+      auto setLayer(std::string const & name, LayerProperties properties, Transition transition = {}) -> bool {
+        auto it = layers.find(name);
+        if (it == layers.end()) {
+          return false;
+        }
+        auto& layer = it->second;
+        if (layer.properties.z != properties.z) {
+          restack = true;
+          layer.restacked = true;
+        }
+        if (layer.properties.visible != properties.visible) {
+          if (transition.kind == Transition::Kind::Cut || transition.frames <= 0) {
+            layer.animation.reset();
+          } else {
+            layer.animation = Layer::Animation
+              { transition
+              , layer.visibility(frame)
+              , properties.visible ? 1.0f : 0.0f
+              , frame + 1
+              };
+          }
+        }
+        layer.properties = properties;
+        return true;
+      }
+
+      // Adds the layer on top if it doesn't exist yet, the source writes all of it
+      auto lock(std::string const & name) -> Buffer {
+        auto& layer = findOrAdd(name);
+        layer.dirty.push_back({{0, 0}, layer.size});
+        return lock(layer);
+      }
+
+      // The same but the source only changes what is in dirty, in its own coordinates
+      auto lock(std::string const & name, std::vector<L2D::Rect> const & dirty) -> Buffer {
+        auto& layer = findOrAdd(name);
+        layer.dirty.insert(layer.dirty.end(), dirty.begin(), dirty.end());
+        return lock(layer);
+      }
+
+      // The source has nothing to show, the layer keeps its properties
+      auto hide(std::string const & name) {
+        if (auto it = layers.find(name); it != layers.end()) {
+          it->second.hasContent = false;
+        }
+      }
+
+      // Draws everything again in the next frame, for when the window was uncovered
+      void redraw() {
+        damage.all();
+      }
+
+      auto presentedFrames() const { return frame; }
+
+      // Replaces any sink with the same name
+      void addSink(std::string const & name, Sink sink) {
+        sinks[name] = std::move(sink);
+        // Nothing has been read back for it yet
+        damage.all();
+      }
+
+      auto removeSink(std::string const & name) -> bool {
+        return sinks.erase(name) > 0;
+      }
+
+      // Called with the number of the next frame once it has been presented,
+      // so with the frame in which any changes made before now first appear
+      void afterNextFrame(std::function<void(uint64_t)> callback) {
+        onPresented.push_back(std::move(callback));
+      }
+
+      // Bottom to top
+      auto json() -> std::string {
+        auto rect = [](std::optional<L2D::Rect> const & rect) {
+          return rect
+            ? fmt::format("[{},{},{},{}]", rect->x, rect->y, rect->w, rect->h)
+            : std::string{"null"};
+        };
+        auto result = std::string{"["};
+        for (auto layer : sorted()) {
+          auto const & properties = layer->properties;
+          if (result.size() > 1) {
+            result += ',';
+          }
+          result += fmt::format
+            ( R"({{"name":"{}","z":{},"visible":{},"opacity":{},"dst":{},"crop":{},"has_content":{},"in_transition":{}}})"
+            , layer->name, properties.z, properties.visible, properties.opacity
+            , rect(properties.dst), rect(properties.crop), layer->hasContent
+            , layer->animation.has_value()
+            );
+        }
+        result += ']';
+        return result;
+      }
+
+      // Nothing is drawn or presented if nothing changed, the sinks get the
+      // last frame again
       auto render() {
-        renderer.fill
-          ( {0, 0, 3840, 1080}
-          , {0, 0, 0, 0}
-          , L2D::BlendMode::None()
-          );
-        for (auto& [shown, texture] : textures) {
-          if (shown) {
-            texture.render
-              ( {0, 0, 1920, 1080}
-              , L2D::BlendMode::Custom
-                ( SDL_BLENDFACTOR_ONE
-                , SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA
-                , SDL_BLENDOPERATION_ADD
-                , SDL_BLENDFACTOR_ONE
-                , SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA
-                , SDL_BLENDOPERATION_ADD
-                )
+        sorted();
+        collectDamage();
+        if (damage.any()) {
+          if (gpu()) {
+            renderer->fill
+              ( {0, 0, 3840, 1080}
+              , {0, 0, 0, 0}
+              , L2D::BlendMode::None()
               );
-            texture.render
+            draw({0, 0});
+            draw({outputSize.w, 0});
+            renderer->fill
               ( {1920, 0, 1920, 1080}
+              , {255, 255, 255, 255}
               , L2D::BlendMode::Custom
-                ( SDL_BLENDFACTOR_ONE
-                , SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA
+                ( SDL_BLENDFACTOR_DST_ALPHA
+                , SDL_BLENDFACTOR_ZERO
                 , SDL_BLENDOPERATION_ADD
                 , SDL_BLENDFACTOR_ONE
-                , SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA
+                , SDL_BLENDFACTOR_ZERO
                 , SDL_BLENDOPERATION_ADD
                 )
               );
+            if (!sinks.empty()) {
+              allocateReadback();
+              renderer->readPixels({{0, 0}, frameSize}, L2D::Surface::Format::BGRA32, readback.data(), framePitch);
+            }
+            renderer->present();
+          } else {
+            composite();
+            if (output) {
+              // Fill and key
+              auto const bounds = damage.bounds();
+              for (auto const origin : {L2D::Point{0, 0}, L2D::Point{outputSize.w, 0}}) {
+                output->update(bounds + origin, readback.data() + (bounds.y * frameSize.w + bounds.x + origin.x) * 4, framePitch);
+              }
+              output->render(L2D::BlendMode::None());
+              renderer->present();
+            }
+          }
+        }
+        damage.clear();
+        frame += 1;
+
+        for (auto& [name, sink] : sinks) {
+          sink(Frame{frame, frameSize, readback.data(), framePitch});
+        }
+
+        for (auto layer : stack) {
+          if (layer->animation && layer->animation->lastFrame() <= frame) {
+            layer->animation.reset();
           }
         }
-        renderer.fill
-          ( {1920, 0, 1920, 1080}
-          , {255, 255, 255, 255}
-          , L2D::BlendMode::Custom
-            ( SDL_BLENDFACTOR_DST_ALPHA
-            , SDL_BLENDFACTOR_ZERO
-            , SDL_BLENDOPERATION_ADD
-            , SDL_BLENDFACTOR_ONE
-            , SDL_BLENDFACTOR_ZERO
-            , SDL_BLENDOPERATION_ADD
-            )
-          );
-        renderer.present();
+
+        for (auto& callback : std::exchange(onPresented, {})) {
+          callback(frame);
+        }
       }
   };
 }
@@ -4,19 +4,36 @@
 #include <cstdio>
 #include <iostream>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cmath>
+#include <cstddef>
 #include <cstring>
 #include <functional>
 #include <iterator>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <new>
 #include <optional>
 #include <string>
 #include <type_traits>
+#include <utility>
 #include <vector>
 
+#include "Kernels.hpp"
 #include "sdl.hpp"
 
+#if defined(__linux__)
+#include <sys/mman.h>
+#elif defined(_WIN32)
+#include <malloc.h>
+#else
+#include <cstdlib>
+#endif
+
 template <typename T, typename U>
 auto lerp(T a, T b, U t) {
   return t < 0.5 ? a + t * (b - a) : b + (1 - t) * (a - b);
@@ -33,8 +50,10 @@ namespace L2D {
 
   class L2DInit : public L2DWitness {
     public:
-      L2DInit() {
-        if (SDL_Init(SDL_INIT_EVERYTHING) < 0) {
+      L2DInit() : L2DInit{SDL_INIT_EVERYTHING} {}
+
+      L2DInit(Uint32 flags) {
+        if (SDL_Init(flags) < 0) {
           std::cerr << "SDL Init failed\n";
           std::terminate();
         }
@@ -118,6 +137,17 @@ namespace L2D {
       return Rect{left, top, right - left, bottom - top};
     }
 
+    // Empty if they don't overlap
+    friend auto operator&(Rect lhs, Rect rhs) {
+      auto top    = std::max(lhs.top(),    rhs.top());
+      auto bottom = std::min(lhs.bottom(), rhs.bottom());
+      auto left   = std::max(lhs.left(),   rhs.left());
+      auto right  = std::min(lhs.right(),  rhs.right());
+      return Rect{left, top, std::max(right - left, 0), std::max(bottom - top, 0)};
+    }
+
+    auto empty() const { return w <= 0 || h <= 0; }
+
     template <typename T>
     friend auto lerp(Rect a, Rect b, T t) {
       return Rect
@@ -138,14 +168,16 @@ namespace L2D {
 
       auto withAlpha(int alpha) const { return Colour{r, g, b, static_cast<uint8_t>(a * alpha / 255)}; }
 
+      // The colour in linear light, it isn't premultiplied so that can be
+      // done channel by channel
       template <typename T>
       friend auto lerp(Colour a, Colour b, T t) {
-        constexpr auto square = [](auto x) { return x * x; };
+        auto const weight = Kernels::lerpWeight(static_cast<double>(t));
         return Colour
-          { static_cast<uint8_t>(std::sqrt(lerp(square(a.r), square(b.r), t)))
-          , static_cast<uint8_t>(std::sqrt(lerp(square(a.g), square(b.g), t)))
-          , static_cast<uint8_t>(std::sqrt(lerp(square(a.b), square(b.b), t)))
-          , static_cast<uint8_t>(std::sqrt(lerp(square(a.a), square(b.a), t)))
+          { Kernels::Scalar::mixLinear(a.r, b.r, weight)
+          , Kernels::Scalar::mixLinear(a.g, b.g, weight)
+          , Kernels::Scalar::mixLinear(a.b, b.b, weight)
+          , static_cast<uint8_t>(Kernels::Scalar::mix(a.a, b.a, weight))
           };
       }
 
@@ -191,6 +223,17 @@ namespace L2D {
             )
           };
       }
+      // Over, for colours that are already multiplied by their alpha
+      static auto PremultipliedOver() {
+        return Custom
+          ( SDL_BLENDFACTOR_ONE
+          , SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA
+          , SDL_BLENDOPERATION_ADD
+          , SDL_BLENDFACTOR_ONE
+          , SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA
+          , SDL_BLENDOPERATION_ADD
+          );
+      }
 
       friend class Surface;
       friend class Texture;
@@ -207,12 +250,325 @@ namespace L2D {
     }
   };
 
+  // Frame sized buffers that go back to the pool rather than being freed, so
+  // a steady stream of frames doesn't allocate or page fault. Sizes are
+  // rounded up to whole huge pages so frames of about the same size share
+  // buffers, and each buffer is touched once when it is allocated.
+  class FramePool {
+    public:
+      static constexpr size_t alignment = 64;
+      static constexpr size_t sizeClass = 2 * 1024 * 1024;
+      static constexpr size_t pageSize = 4096;
+
+      struct Statistics {
+        // From the OS, and handed out again from the pool
+        uint64_t allocations = 0;
+        uint64_t reuses = 0;
+        size_t buffersInUse = 0;
+        size_t bytesInUse = 0;
+        size_t buffersFree = 0;
+        size_t bytesFree = 0;
+        // The most there have been in use at once
+        size_t highWaterBytes = 0;
+      };
+
+      // Shared by its copies, back in the pool once they are all destroyed
+      class Frame {
+        private:
+          std::shared_ptr<uint8_t> memory;
+          size_t bytes = 0;
+
+          Frame(std::shared_ptr<uint8_t> memory, size_t bytes) : memory{std::move(memory)}, bytes{bytes} {}
+
+        public:
+          Frame() = default;
+
+          auto data() const { return memory.get(); }
+          auto size() const { return bytes; }
+
+          explicit operator bool() const { return memory != nullptr; }
+
+          friend class FramePool;
+      };
+
+    private:
+      // Outlives the pool while any of its frames are still in use
+      struct State {
+        std::mutex mutex;
+        bool hugePages;
+        std::map<size_t, std::vector<uint8_t*>> free;
+        Statistics statistics;
+
+        ~State() {
+          for (auto& [bytes, buffers] : free) {
+            for (auto buffer : buffers) {
+              release(buffer, bytes);
+            }
+          }
+        }
+      };
+      std::shared_ptr<State> state;
+
+      static auto allocate(size_t bytes, bool hugePages) -> uint8_t* {
+#if defined(__linux__)
+        auto memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+          throw std::bad_alloc{};
+        }
+        if (hugePages) {
+          madvise(memory, bytes, MADV_HUGEPAGE);
+        }
+#elif defined(_WIN32)
+        // Large pages need a privilege most accounts don't have
+        (void)hugePages;
+        auto memory = _aligned_malloc(bytes, alignment);
+        if (!memory) {
+          throw std::bad_alloc{};
+        }
+#else
+        (void)hugePages;
+        void* memory = nullptr;
+        if (posix_memalign(&memory, alignment, bytes) != 0) {
+          throw std::bad_alloc{};
+        }
+#endif
+        std::memset(memory, 0, bytes);
+        return static_cast<uint8_t*>(memory);
+      }
+
+      static void release(uint8_t* memory, size_t bytes) {
+#if defined(__linux__)
+        munmap(memory, bytes);
+#elif defined(_WIN32)
+        (void)bytes;
+        _aligned_free(memory);
+#else
+        (void)bytes;
+        std::free(memory);
+#endif
+      }
+
+    public:
+      // Huge pages are only asked for on Linux, where they also need
+      // transparent huge pages to be enabled for madvise
+      explicit FramePool(bool hugePages = false) : state{std::make_shared<State>()} {
+        state->hugePages = hugePages;
+      }
+
+      FramePool(FramePool const &) = delete;
+      FramePool& operator=(FramePool const &) = delete;
+
+      // Zeroed when it is new, otherwise whatever the last user left in it.
+      // Less than a size class, such as a small still's layer, would waste
+      // most of one, so it is only rounded up to the page and isn't pooled.
+      auto acquire(size_t bytes) -> Frame {
+        auto const pooled = bytes >= sizeClass;
+        auto const unit = pooled ? sizeClass : pageSize;
+        auto const rounded = std::max<size_t>((bytes + unit - 1) / unit, 1) * unit;
+        auto memory = static_cast<uint8_t*>(nullptr);
+        {
+          auto lock = std::unique_lock{state->mutex};
+          auto& statistics = state->statistics;
+          if (auto buffers = pooled ? &state->free[rounded] : nullptr; buffers && !buffers->empty()) {
+            memory = buffers->back();
+            buffers->pop_back();
+            statistics.reuses += 1;
+            statistics.buffersFree -= 1;
+            statistics.bytesFree -= rounded;
+          } else {
+            statistics.allocations += 1;
+          }
+          statistics.buffersInUse += 1;
+          statistics.bytesInUse += rounded;
+          statistics.highWaterBytes = std::max(statistics.highWaterBytes, statistics.bytesInUse);
+        }
+        if (!memory) {
+          memory = allocate(rounded, state->hugePages);
+        }
+        auto recycle = [state = state, rounded, pooled](uint8_t* memory) {
+          {
+            auto lock = std::unique_lock{state->mutex};
+            auto& statistics = state->statistics;
+            statistics.buffersInUse -= 1;
+            statistics.bytesInUse -= rounded;
+            if (pooled) {
+              state->free[rounded].push_back(memory);
+              statistics.buffersFree += 1;
+              statistics.bytesFree += rounded;
+              return;
+            }
+          }
+          release(memory, rounded);
+        };
+        return Frame{std::shared_ptr<uint8_t>{memory, std::move(recycle)}, bytes};
+      }
+
+      auto statistics() const -> Statistics {
+        auto lock = std::unique_lock{state->mutex};
+        return state->statistics;
+      }
+
+      // Gives the buffers that aren't in use back to the OS
+      void trim() {
+        auto lock = std::unique_lock{state->mutex};
+        for (auto& [bytes, buffers] : state->free) {
+          for (auto buffer : buffers) {
+            release(buffer, bytes);
+          }
+        }
+        state->free.clear();
+        state->statistics.buffersFree = 0;
+        state->statistics.bytesFree = 0;
+      }
+
+      // For the frames of the compositor and the outputs
+      static auto shared() -> FramePool& {
+        static auto pool = FramePool{true};
+        return pool;
+      }
+  };
+
+  // Blits that don't go through SDL, whose generic blitters are slow at
+  // premultiplied over with a global alpha. Only the operations and pairs of
+  // formats that have Rows specialised for them are done here, SDL does the
+  // rest.
+  namespace Blit {
+    enum class Operation
+      // Only with an alpha of 255, SDL multiplies any other into the alpha
+      { Copy
+      , PremultipliedOver
+      };
+
+    // The colours are only ever copied or scaled, so their order doesn't
+    // matter as long as both sides have the same one
+    template <Uint32 format>
+    constexpr auto fourBytesAlphaLast = format == SDL_PIXELFORMAT_RGBA32 || format == SDL_PIXELFORMAT_BGRA32;
+
+    template <Operation operation, Uint32 srcFormat, Uint32 dstFormat, typename = void>
+    struct Rows {
+      static constexpr auto supported = false;
+    };
+
+    template <Uint32 format>
+    struct Rows<Operation::Copy, format, format, std::enable_if_t<fourBytesAlphaLast<format>>> {
+      static constexpr auto supported = true;
+
+      static void row(uint8_t* dst, uint8_t const * src, int pixels, Uint8) {
+        std::memcpy(dst, src, pixels * 4);
+      }
+
+      // srcX and step are 16.16 fixed point
+      static void scaledRow(uint8_t* dst, uint8_t const * srcRow, int pixels, uint32_t srcX, uint32_t step, Uint8) {
+        for (auto i = 0; i < pixels; ++i, srcX += step) {
+          std::memcpy(dst + i * 4, srcRow + (srcX >> 16) * 4, 4);
+        }
+      }
+    };
+
+    template <Uint32 format>
+    struct Rows<Operation::PremultipliedOver, format, format, std::enable_if_t<fourBytesAlphaLast<format>>> {
+      static constexpr auto supported = true;
+
+      static void row(uint8_t* dst, uint8_t const * src, int pixels, Uint8 alpha) {
+        Kernels::over(dst, src, pixels, alpha);
+      }
+
+      static void scaledRow(uint8_t* dst, uint8_t const * srcRow, int pixels, uint32_t srcX, uint32_t step, Uint8 alpha) {
+        Kernels::overScaled(dst, srcRow, pixels, srcX, step, alpha);
+      }
+    };
+  }
+
   class Surface : public L2DWitness {
     private:
+      // The pixels, if they are from a pool rather than SDL's
+      FramePool::Frame frame;
       std::unique_ptr<SDL_Surface, lambdaFor<SDL_FreeSurface>> surface;
 
       Surface(L2DWitness l2DWitness, SDL_Surface* rawSurface) : L2DWitness{l2DWitness}, surface{rawSurface} {}
 
+      // Clipped to both surfaces like SDL does, except that a scaled blit
+      // from outside src is left to SDL. Scaled blits take the nearest pixel
+      // to each one's centre in 16.16 fixed point as SDL 2.0.16 does, and
+      // clipping them doesn't move what is drawn.
+      template <typename Rows>
+      auto blitRows(Surface const & src, Rect srcRect, Rect dstRect, Uint8 alpha) -> bool {
+        if constexpr (!Rows::supported) {
+          return false;
+        } else {
+          auto const srcPixels = static_cast<uint8_t const *>(src.surface->pixels);
+          auto const dstPixels = static_cast<uint8_t*>(surface->pixels);
+          auto const srcPitch = src.surface->pitch;
+          auto const dstPitch = surface->pitch;
+          if (srcRect.w == dstRect.w && srcRect.h == dstRect.h) {
+            auto const offset = dstRect.point() - srcRect.point();
+            auto const dst = ((srcRect & src.rect()) + offset) & rect();
+            auto const from = dst - offset;
+            for (auto y = 0; y < dst.h; ++y) {
+              Rows::row
+                ( dstPixels + (dst.y + y) * dstPitch + dst.x * 4
+                , srcPixels + (from.y + y) * srcPitch + from.x * 4
+                , dst.w
+                , alpha
+                );
+            }
+            return true;
+          }
+          if (!((srcRect & src.rect()) == srcRect) || srcRect.empty() || dstRect.empty()) {
+            return false;
+          }
+          auto const dst = dstRect & rect();
+          auto const step = static_cast<uint32_t>((static_cast<uint64_t>(srcRect.w) << 16) / dstRect.w);
+          auto const stepY = static_cast<uint32_t>((static_cast<uint64_t>(srcRect.h) << 16) / dstRect.h);
+          auto const srcX = (static_cast<uint32_t>(srcRect.x) << 16) + step / 2 + (dst.x - dstRect.x) * step;
+          for (auto y = dst.y; y < dst.bottom(); ++y) {
+            auto const srcY = srcRect.y + static_cast<int>((stepY / 2 + static_cast<uint32_t>(y - dstRect.y) * stepY) >> 16);
+            Rows::scaledRow(dstPixels + y * dstPitch + dst.x * 4, srcPixels + srcY * srcPitch, dst.w, srcX, step, alpha);
+          }
+          return true;
+        }
+      }
+
+      // The formats are picked at runtime, the rows for them at compile time
+      template <Blit::Operation operation, Uint32 srcFormat>
+      auto blitTo(Surface const & src, Rect srcRect, Rect dstRect, Uint8 alpha) -> bool {
+        switch (surface->format->format) {
+          case SDL_PIXELFORMAT_RGBA32:
+            return blitRows<Blit::Rows<operation, srcFormat, SDL_PIXELFORMAT_RGBA32>>(src, srcRect, dstRect, alpha);
+          case SDL_PIXELFORMAT_BGRA32:
+            return blitRows<Blit::Rows<operation, srcFormat, SDL_PIXELFORMAT_BGRA32>>(src, srcRect, dstRect, alpha);
+          default:
+            return false;
+        }
+      }
+
+      template <Blit::Operation operation>
+      auto blitFrom(Surface const & src, Rect srcRect, Rect dstRect, Uint8 alpha) -> bool {
+        switch (src.surface->format->format) {
+          case SDL_PIXELFORMAT_RGBA32:
+            return blitTo<operation, SDL_PIXELFORMAT_RGBA32>(src, srcRect, dstRect, alpha);
+          case SDL_PIXELFORMAT_BGRA32:
+            return blitTo<operation, SDL_PIXELFORMAT_BGRA32>(src, srcRect, dstRect, alpha);
+          default:
+            return false;
+        }
+      }
+
+      // False if SDL has to do it, as it does onto the same surface since
+      // the rows would overlap
+      auto blitWithoutSDL(Surface const & src, Rect srcRect, Rect dstRect, Uint8 alpha, BlendMode blendMode) -> bool {
+        if (&src == this || SDL_MUSTLOCK(surface.get()) || SDL_MUSTLOCK(src.surface.get())) {
+          return false;
+        }
+        if (blendMode.blendMode == BlendMode::PremultipliedOver().blendMode) {
+          return blitFrom<Blit::Operation::PremultipliedOver>(src, srcRect, dstRect, alpha);
+        }
+        if (blendMode.blendMode == SDL_BLENDMODE_NONE && alpha == 255) {
+          return blitFrom<Blit::Operation::Copy>(src, srcRect, dstRect, alpha);
+        }
+        return false;
+      }
+
     public:
       Surface() = delete;
 
@@ -224,9 +580,21 @@ namespace L2D {
       Surface(L2DWitness l2DWitness, Size size, Format format = Format::RGBA32)
         : Surface{l2DWitness, SDL_CreateRGBSurfaceWithFormat(0, size.w, size.h, 0, static_cast<SDL_PixelFormatEnum>(format))} {}
 
+      // Draws straight into the frame, which it keeps until it is destroyed
+      Surface(L2DWitness l2DWitness, FramePool::Frame frame, Size size, int pitch, Format format = Format::RGBA32)
+        : Surface{l2DWitness, SDL_CreateRGBSurfaceWithFormatFrom(frame.data(), size.w, size.h, 32, pitch, static_cast<SDL_PixelFormatEnum>(format))}
+        {
+        this->frame = std::move(frame);
+      }
+
       auto width()  const { return surface->w; }
       auto height() const { return surface->h; }
       auto rect() const { return Rect{0, 0, surface->w, surface->h}; }
+      auto pitch()  const { return surface->pitch; }
+
+      // Not for surfaces that have to be locked
+      auto pixels()       { return static_cast<uint8_t*>(surface->pixels); }
+      auto pixels() const { return static_cast<uint8_t const*>(surface->pixels); }
 
       void fill(Colour colour) {
         SDL_FillRect(surface.get(), nullptr, colour.mapToFormat(surface->format));
@@ -236,7 +604,12 @@ namespace L2D {
         SDL_FillRect(surface.get(), &rect, colour.mapToFormat(surface->format));
       }
 
+      // Premultiplied over, and copies with no blending, between BGRA32 and
+      // RGBA32 surfaces of the same format don't go through SDL
       void blit(Surface const & src, Point dstTopLeft = {0, 0}, Uint8 alpha = 255, BlendMode blendMode = BlendMode::Blend()) {
+        if (blitWithoutSDL(src, src.rect(), Rect{dstTopLeft, src.rect().size()}, alpha, blendMode)) {
+          return;
+        }
         SDL_SetSurfaceAlphaMod(src.surface.get(), alpha);
         SDL_SetSurfaceBlendMode(src.surface.get(), blendMode.blendMode);
         auto dstRect = Rect{dstTopLeft.x, dstTopLeft.y, 0, 0};
@@ -244,6 +617,9 @@ namespace L2D {
       }
 
       void blit(Surface const & src, Rect srcRect, Point dstTopLeft, Uint8 alpha = 255, BlendMode blendMode = BlendMode::Blend()) {
+        if (blitWithoutSDL(src, srcRect, Rect{dstTopLeft, srcRect.size()}, alpha, blendMode)) {
+          return;
+        }
         SDL_SetSurfaceAlphaMod(src.surface.get(), alpha);
         SDL_SetSurfaceBlendMode(src.surface.get(), blendMode.blendMode);
         auto dstRect = Rect{dstTopLeft.x, dstTopLeft.y, 0, 0};
@@ -251,12 +627,18 @@ namespace L2D {
       }
 
       void blit(Surface const & src, Rect dstRect, Uint8 alpha = 255, BlendMode blendMode = BlendMode::Blend()) {
+        if (blitWithoutSDL(src, src.rect(), dstRect, alpha, blendMode)) {
+          return;
+        }
         SDL_SetSurfaceAlphaMod(src.surface.get(), alpha);
         SDL_SetSurfaceBlendMode(src.surface.get(), blendMode.blendMode);
         SDL_BlitScaled(src.surface.get(), nullptr, this->surface.get(), &dstRect);
       }
 
       void blit(Surface const & src, Rect srcRect, Rect dstRect, Uint8 alpha = 255, BlendMode blendMode = BlendMode::Blend()) {
+        if (blitWithoutSDL(src, srcRect, dstRect, alpha, blendMode)) {
+          return;
+        }
         SDL_SetSurfaceAlphaMod(src.surface.get(), alpha);
         SDL_SetSurfaceBlendMode(src.surface.get(), blendMode.blendMode);
         SDL_BlitScaled(src.surface.get(), &srcRect, this->surface.get(), &dstRect);
@@ -362,6 +744,22 @@ namespace L2D {
         SDL_SetRenderDrawBlendMode(renderer.get(), oldBlendMode);
       }
 
+      // SDL falls back to drawing on the CPU when there is no GPU
+      auto software() const -> bool {
+        SDL_RendererInfo info;
+        return SDL_GetRendererInfo(renderer.get(), &info) == 0 && (info.flags & SDL_RENDERER_SOFTWARE);
+      }
+
+      void clip(Rect rect) { SDL_RenderSetClipRect(renderer.get(), &rect); }
+      void unclip() { SDL_RenderSetClipRect(renderer.get(), nullptr); }
+
+      // Has to be before present, the back buffer is undefined afterwards
+      void readPixels(Rect rect, Surface::Format format, void* pixels, int pitch) {
+        if (0 != SDL_RenderReadPixels(renderer.get(), &rect, static_cast<SDL_PixelFormatEnum>(format), pixels, pitch)) {
+          std::cerr << SDL_GetError();
+        }
+      }
+
       void present() { SDL_RenderPresent(renderer.get()); }
 
       friend class Texture;
@@ -427,6 +825,35 @@ namespace L2D {
         SDL_RenderCopy(rawRenderer, texture.get(), nullptr, &dst);
       }
 
+      void render(Rect src, Rect dst, BlendMode blendMode) {
+        if (0 != SDL_SetTextureBlendMode(texture.get(), blendMode.blendMode)) {
+          std::cerr << SDL_GetError();
+        }
+        SDL_RenderCopy(rawRenderer, texture.get(), &src, &dst);
+      }
+
+      // Replaces the whole texture
+      void update(void const * pixels, int pitch) {
+        if (0 != SDL_UpdateTexture(texture.get(), nullptr, pixels, pitch)) {
+          std::cerr << SDL_GetError();
+        }
+      }
+
+      // Replaces part of it, pixels points at the top left of rect
+      void update(Rect rect, void const * pixels, int pitch) {
+        if (0 != SDL_UpdateTexture(texture.get(), &rect, pixels, pitch)) {
+          std::cerr << SDL_GetError();
+        }
+      }
+
+      void setAlphaMod(Uint8 alpha) {
+        SDL_SetTextureAlphaMod(texture.get(), alpha);
+      }
+
+      void setColourMod(Colour colour) {
+        SDL_SetTextureColorMod(texture.get(), colour.r, colour.g, colour.b);
+      }
+
       class Unlocker {
         private:
           SDL_Texture* texture;
@@ -591,6 +1018,104 @@ namespace L2D {
           }
         }
     };
+
+    // For values sent to the main thread often, without SDL's queue and its
+    // lock for each of them or allocating. Any thread can push, only the
+    // main thread pops. A push when there was nothing waiting wakes the
+    // main loop with one SDL event, the rest go without.
+    //
+    // A bounded queue of slots with sequence numbers, as Vyukov's. Pushes
+    // claim a slot by moving the tail on, then mark it full once written.
+    template <typename T, size_t capacity>
+    class Channel {
+      private:
+        static_assert(capacity > 0 && (capacity & (capacity - 1)) == 0, "Channel capacity has to be a power of two");
+
+        struct Slot {
+          // The position it can be pushed at, or one after it once full
+          std::atomic<size_t> sequence;
+          alignas(T) unsigned char storage[sizeof(T)];
+        };
+
+        Uint32 const type;
+        std::array<Slot, capacity> slots;
+        // Apart so the pushes don't keep taking the line from the main thread
+        alignas(64) std::atomic<size_t> tail{0};
+        alignas(64) size_t head = 0;
+        // An SDL event has been pushed and not yet parsed
+        std::atomic<bool> signalled{false};
+
+      public:
+        Channel(L2DWitness) : type{SDL_RegisterEvents(1)} {
+          for (size_t i = 0; i < capacity; ++i) {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+          }
+        }
+
+        Channel(Channel const &) = delete;
+        Channel& operator=(Channel const &) = delete;
+
+        ~Channel() {
+          while (pop()) {}
+        }
+
+        // False, and nothing is pushed, if the main thread has let it fill up
+        template <typename ...Args>
+        auto push(Args&& ...args) -> bool {
+          auto position = tail.load(std::memory_order_relaxed);
+          Slot* slot;
+          while (true) {
+            slot = &slots[position & (capacity - 1)];
+            auto const sequence = slot->sequence.load(std::memory_order_acquire);
+            auto const difference = static_cast<std::ptrdiff_t>(sequence - position);
+            if (difference == 0) {
+              if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                break;
+              }
+            } else if (difference < 0) {
+              return false;
+            } else {
+              position = tail.load(std::memory_order_relaxed);
+            }
+          }
+          new(slot->storage) T{std::forward<Args>(args)...};
+          slot->sequence.store(position + 1, std::memory_order_release);
+
+          if (!signalled.exchange(true, std::memory_order_acq_rel)) {
+            SDL_Event event{};
+            event.type = type;
+            // With SDL's queue full, the next push tries again
+            if (SDL_PushEvent(&event) != 1) {
+              signalled.store(false, std::memory_order_release);
+            }
+          }
+          return true;
+        }
+
+        // Whether it is this channel's event. Pop everything after it, what
+        // is pushed from then on sends another.
+        auto parse(SDL_Event const & event) -> bool {
+          if (event.type != type) {
+            return false;
+          }
+          signalled.store(false, std::memory_order_seq_cst);
+          return true;
+        }
+
+        // On the main thread
+        auto pop() -> std::optional<T> {
+          auto& slot = slots[head & (capacity - 1)];
+          if (slot.sequence.load(std::memory_order_acquire) != head + 1) {
+            return std::nullopt;
+          }
+          auto value = reinterpret_cast<T*>(slot.storage);
+          auto result = std::optional<T>{std::move(*value)};
+          value->~T();
+          slot.sequence.store(head + capacity, std::memory_order_release);
+          head += 1;
+          return result;
+        }
+    };
   };
 
   template <typename Callback>
@@ -0,0 +1,140 @@
+#ifndef NDIOutput_hpp
+#define NDIOutput_hpp
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <string>
+
+#include "Kernels.hpp"
+#include "KeyFill.hpp"
+#include "Light2D.hpp"
+#include "NDI.hpp"
+#include "ThreadPool.hpp"
+
+// Publishes the composite over NDI
+namespace NDIOutput {
+  enum class Mode
+    // One source, the fill with the key as its alpha
+    { Alpha
+    // Separate fill and key sources
+    , KeyFill
+    };
+
+  // A sink for KeyFill::Windows. The sends are asynchronous, so each frame goes
+  // into whichever buffer NDI has finished with. The fill sender is clocked,
+  // which holds the output to the frame rate.
+  class Sender {
+    private:
+      static constexpr auto stripeRows = 16;
+
+      NDIlib const & ndilib;
+      Mode mode;
+      Kernels::Split split;
+      int frameRateN;
+      int frameRateD;
+      NDIlib_send_instance_t fill = nullptr;
+      NDIlib_send_instance_t key = nullptr;
+
+      // The fill followed by the key
+      std::array<L2D::FramePool::Frame, 2> buffers;
+      size_t next = 0;
+
+      void send(NDIlib_send_instance_t instance, NDIlib_FourCC_video_type_e fourCC, L2D::Size size, uint8_t* data, int pitch) {
+        auto const videoFrame = NDIlib_video_frame_v2_t
+          { size.w
+          , size.h
+          , fourCC
+          , frameRateN
+          , frameRateD
+          , static_cast<float>(size.w) / size.h
+          , NDIlib_frame_format_type_progressive
+          , NDIlib_send_timecode_synthesize
+          , data
+          , pitch
+          };
+        ndilib->send_send_video_async_v2(instance, &videoFrame);
+      }
+
+    public:
+      // NDI wants the fill without the alpha multiplied in when it has the
+      // alpha, so split.straight is only up to the caller for Mode::KeyFill
+      Sender(NDIlib const & ndilib, std::string const & name, Mode mode, Kernels::Split split, int frameRateN, int frameRateD)
+        : ndilib{ndilib}
+        , mode{mode}
+        , split{split}
+        , frameRateN{frameRateN}
+        , frameRateD{frameRateD}
+        {
+        auto const fillName = mode == Mode::Alpha ? name : name + " Fill";
+        auto const fillSettings = NDIlib_send_create_t{fillName.c_str(), nullptr, true, false};
+        fill = ndilib->send_create(&fillSettings);
+        if (mode == Mode::KeyFill) {
+          // Only one sender is clocked, otherwise each frame would wait twice
+          auto const keyName = name + " Key";
+          auto const keySettings = NDIlib_send_create_t{keyName.c_str(), nullptr, false, false};
+          key = ndilib->send_create(&keySettings);
+        } else {
+          this->split.straight = true;
+        }
+        this->split.key = Kernels::Split::Key::Grey;
+      }
+
+      Sender(Sender const &) = delete;
+      Sender& operator=(Sender const &) = delete;
+
+      ~Sender() {
+        // Sending nothing waits until NDI has finished with the last buffer
+        for (auto instance : {fill, key}) {
+          if (instance) {
+            ndilib->send_send_video_async_v2(instance, nullptr);
+            ndilib->send_destroy(instance);
+          }
+        }
+      }
+
+      auto ok() const { return fill && (mode == Mode::Alpha || key); }
+
+      void operator()(KeyFill::Frame const & frame) {
+        auto const size = L2D::Size{frame.size.w / 2, frame.size.h};
+        auto const pitch = size.w * 4;
+        auto& buffer = buffers[next];
+        next ^= 1;
+        auto const bytes = static_cast<size_t>(pitch * size.h * (mode == Mode::KeyFill ? 2 : 1));
+        if (buffer.size() != bytes) {
+          buffer = L2D::FramePool::shared().acquire(bytes);
+        }
+        auto const keyOut = buffer.data() + pitch * size.h;
+
+        // The key is taken from the right of the frame, a window doesn't
+        // always keep the alpha of the fill
+        auto const stripes = static_cast<size_t>((size.h + stripeRows - 1) / stripeRows);
+        ThreadPool::ThreadPool::shared().forEach(stripes, [&](size_t stripe) {
+          auto const top = static_cast<int>(stripe) * stripeRows;
+          for (auto y = top; y < std::min(top + stripeRows, size.h); ++y) {
+            auto const fillRow = frame.pixels + y * frame.pitch;
+            Kernels::split
+              ( fillRow
+              , fillRow + pitch
+              , buffer.data() + y * pitch
+              , mode == Mode::KeyFill ? keyOut + y * pitch : nullptr
+              , size.w
+              , split
+              );
+          }
+        });
+
+        switch (mode) {
+          case Mode::Alpha:
+            send(fill, NDIlib_FourCC_video_type_BGRA, size, buffer.data(), pitch);
+            break;
+          case Mode::KeyFill:
+            send(fill, NDIlib_FourCC_video_type_BGRX, size, buffer.data(), pitch);
+            send(key, NDIlib_FourCC_video_type_BGRX, size, keyOut, pitch);
+            break;
+        }
+      }
+  };
+}
+
+#endif
@@ -0,0 +1,702 @@
+#ifndef Overlay_hpp
+#define Overlay_hpp
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include FT_BITMAP_H
+
+#include "Kernels.hpp"
+#include "KeyFill.hpp"
+#include "Light2D.hpp"
+
+// Text and rects with round corners drawn without a browser into a layer of
+// their own, for clocks, countdowns and name straps. Glyphs are rasterised
+// once into an atlas and only what changed since the last frame is drawn again.
+namespace Overlay {
+  using SystemClock = std::chrono::system_clock;
+
+  enum class Align { Left, Centre, Right };
+
+  struct Element {
+    enum class Kind { Text, Rect };
+
+    Kind kind = Kind::Text;
+    int z = 0;
+    float opacity = 1;
+    // Not premultiplied
+    L2D::Colour colour = {255, 255, 255, 255};
+
+    // x is the left, centre or right of each line as aligned, y the top of the first
+    std::string text;
+    // A path, the default font if empty
+    std::string font;
+    int size = 48;
+    int x = 0;
+    int y = 0;
+    Align align = Align::Left;
+    // Shows the local time in strftime's format instead of the text
+    std::string clock;
+    // Shows the time left until then instead of the text
+    std::optional<SystemClock::time_point> until;
+
+    L2D::Rect rect = {0, 0, 0, 0};
+    int radius = 0;
+  };
+
+  struct Glyph {
+    // Where its coverage is in the atlas, empty for spaces
+    L2D::Rect atlas = {0, 0, 0, 0};
+    // From the pen on the baseline to the top left of the bitmap
+    int left = 0;
+    int top = 0;
+    int advance = 0;
+  };
+
+  // The 8 bit coverage of the glyphs, packed left to right in shelves
+  class Atlas {
+    public:
+      static constexpr auto width = 1024;
+      static constexpr auto maxHeight = 4096;
+
+    private:
+      std::vector<uint8_t> pixels;
+      int shelfX = 0;
+      int shelfY = 0;
+      int shelfHeight = 0;
+
+    public:
+      // Whether it would fit in an empty atlas
+      static auto fits(L2D::Size size) { return size.w <= width && size.h <= maxHeight; }
+
+      // Where the bitmap went, nothing if it is full or it doesn't fit
+      auto add(L2D::Size size, uint8_t const * bitmap, int pitch) -> std::optional<L2D::Rect> {
+        if (!fits(size)) {
+          return std::nullopt;
+        }
+        if (shelfX + size.w > width) {
+          shelfX = 0;
+          shelfY += shelfHeight;
+          shelfHeight = 0;
+        }
+        if (shelfY + size.h > maxHeight) {
+          return std::nullopt;
+        }
+        auto const rect = L2D::Rect{shelfX, shelfY, size.w, size.h};
+        shelfX += size.w + 1;
+        shelfHeight = std::max(shelfHeight, size.h + 1);
+        if (static_cast<int>(pixels.size()) < (shelfY + shelfHeight) * width) {
+          pixels.resize(static_cast<size_t>(std::min(std::max(shelfY + shelfHeight, 2 * static_cast<int>(pixels.size()) / width), maxHeight)) * width);
+        }
+        for (auto y = 0; y < size.h; ++y) {
+          std::memcpy(row(rect, y), bitmap + y * pitch, static_cast<size_t>(size.w));
+        }
+        return rect;
+      }
+
+      auto row(L2D::Rect rect, int y) -> uint8_t* { return pixels.data() + (rect.y + y) * width + rect.x; }
+      auto row(L2D::Rect rect, int y) const -> uint8_t const * { return pixels.data() + (rect.y + y) * width + rect.x; }
+
+      void clear() {
+        pixels.clear();
+        shelfX = 0;
+        shelfY = 0;
+        shelfHeight = 0;
+      }
+  };
+
+  class Fonts {
+    private:
+      struct Library {
+        FT_Library library = nullptr;
+
+        Library() { FT_Init_FreeType(&library); }
+        Library(Library const &) = delete;
+        Library& operator=(Library const &) = delete;
+        ~Library() { FT_Done_FreeType(library); }
+      };
+
+      struct FaceDeleter {
+        void operator()(FT_Face face) const { FT_Done_Face(face); }
+      };
+
+      // Before the faces so it goes after them
+      Library library;
+      std::map<std::string, std::unique_ptr<FT_FaceRec_, FaceDeleter>> faces;
+      Atlas atlas;
+      std::map<std::tuple<FT_Face, int, char32_t>, Glyph> glyphs;
+      // Goes up when the atlas fills and is cleared
+      uint64_t generation = 0;
+      uint64_t rasterised = 0;
+
+      static void setSize(FT_Face face, int size) {
+        if (face->size->metrics.y_ppem != size) {
+          FT_Set_Pixel_Sizes(face, 0, static_cast<FT_UInt>(size));
+        }
+      }
+
+      // 8 bit coverage from the top row down. 1, 2 or 4 bit embedded bitmaps
+      // are converted to 8 bits, in converted, and scaled up to 255.
+      auto grey(FT_Bitmap const & bitmap, FT_Bitmap & converted) -> FT_Bitmap const * {
+        if (bitmap.pixel_mode == FT_PIXEL_MODE_GRAY && bitmap.num_grays == 256 && bitmap.pitch > 0) {
+          return &bitmap;
+        }
+        if (FT_Bitmap_Convert(library.library, &bitmap, &converted, 1) != 0) {
+          return nullptr;
+        }
+        if (converted.num_grays > 1 && converted.num_grays < 256) {
+          auto const levels = static_cast<uint32_t>(converted.num_grays - 1);
+          for (auto y = 0u; y < converted.rows; ++y) {
+            auto const row = converted.buffer + y * static_cast<unsigned>(converted.pitch);
+            for (auto x = 0u; x < converted.width; ++x) {
+              row[x] = static_cast<uint8_t>(std::min(row[x] * 255 / levels, 255u));
+            }
+          }
+        }
+        return &converted;
+      }
+
+    public:
+      // Loaded the first time, nullptr if it can't be
+      auto face(std::string const & path) -> FT_Face {
+        if (auto it = faces.find(path); it != faces.end()) {
+          return it->second.get();
+        }
+        auto face = FT_Face{};
+        if (!library.library || FT_New_Face(library.library, path.c_str(), 0, &face) != 0) {
+          return nullptr;
+        }
+        faces.emplace(path, face);
+        return face;
+      }
+
+      auto glyph(FT_Face face, int size, char32_t codepoint) -> Glyph {
+        auto const key = std::tuple{face, size, codepoint};
+        if (auto it = glyphs.find(key); it != glyphs.end()) {
+          return it->second;
+        }
+        setSize(face, size);
+        auto glyph = Glyph{};
+        if (FT_Load_Char(face, codepoint, FT_LOAD_RENDER | FT_LOAD_TARGET_NORMAL) == 0) {
+          auto const & slot = *face->glyph;
+          glyph.left = slot.bitmap_left;
+          glyph.top = slot.bitmap_top;
+          glyph.advance = static_cast<int>(slot.advance.x >> 6);
+          auto const bitmapSize = L2D::Size{static_cast<int>(slot.bitmap.width), static_cast<int>(slot.bitmap.rows)};
+          // One too big for the atlas is left out rather than emptying it for nothing
+          if (bitmapSize.w > 0 && bitmapSize.h > 0 && Atlas::fits(bitmapSize)) {
+            auto coverage = FT_Bitmap{};
+            FT_Bitmap_Init(&coverage);
+            if (auto const bitmap = grey(slot.bitmap, coverage)) {
+              auto placed = atlas.add(bitmapSize, bitmap->buffer, bitmap->pitch);
+              if (!placed) {
+                atlas.clear();
+                glyphs.clear();
+                generation += 1;
+                placed = atlas.add(bitmapSize, bitmap->buffer, bitmap->pitch);
+              }
+              glyph.atlas = placed.value_or(L2D::Rect{0, 0, 0, 0});
+            }
+            FT_Bitmap_Done(library.library, &coverage);
+          }
+          rasterised += 1;
+        }
+        glyphs.emplace(key, glyph);
+        return glyph;
+      }
+
+      // From the top of a line to its baseline, and from one baseline to the next
+      auto ascender(FT_Face face, int size) -> int {
+        setSize(face, size);
+        return static_cast<int>(face->size->metrics.ascender >> 6);
+      }
+
+      auto lineHeight(FT_Face face, int size) -> int {
+        setSize(face, size);
+        return static_cast<int>(face->size->metrics.height >> 6);
+      }
+
+      auto kerning(FT_Face face, int size, char32_t left, char32_t right) -> int {
+        if (!FT_HAS_KERNING(face)) {
+          return 0;
+        }
+        setSize(face, size);
+        auto delta = FT_Vector{};
+        FT_Get_Kerning(face, FT_Get_Char_Index(face, left), FT_Get_Char_Index(face, right), FT_KERNING_DEFAULT, &delta);
+        return static_cast<int>(delta.x >> 6);
+      }
+
+      auto coverage() const -> Atlas const & { return atlas; }
+      auto atlasGeneration() const { return generation; }
+      auto cachedGlyphs() const { return glyphs.size(); }
+      auto rasterisedGlyphs() const { return rasterised; }
+  };
+
+  // Code points, anything that isn't valid UTF-8 as U+FFFD
+  inline auto decode(std::string const & text) -> std::vector<char32_t> {
+    auto result = std::vector<char32_t>{};
+    for (size_t i = 0; i < text.size();) {
+      auto const lead = static_cast<uint8_t>(text[i]);
+      auto const length = lead < 0x80 ? 1 : (lead >> 5) == 0x6 ? 2 : (lead >> 4) == 0xE ? 3 : (lead >> 3) == 0x1E ? 4 : 0;
+      if (length == 0 || i + length > text.size()) {
+        result.push_back(0xFFFD);
+        i += 1;
+        continue;
+      }
+      auto codepoint = static_cast<char32_t>(length == 1 ? lead : lead & (0x7F >> length));
+      auto valid = true;
+      for (auto j = 1; j < length; ++j) {
+        auto const next = static_cast<uint8_t>(text[i + j]);
+        valid = valid && (next >> 6) == 0x2;
+        codepoint = (codepoint << 6) | (next & 0x3F);
+      }
+      result.push_back(valid ? codepoint : 0xFFFD);
+      i += valid ? length : 1;
+    }
+    return result;
+  }
+
+  // The drawing for the KeyFill layer, all of it on the UI thread
+  class Overlay {
+    public:
+      static constexpr auto layerName = "overlay";
+
+    private:
+      struct Animation {
+        Element from;
+        KeyFill::Transition transition;
+        uint64_t firstFrame;
+
+        auto lastFrame() const { return firstFrame + transition.frames - 1; }
+      };
+
+      struct Item {
+        Element element;
+        std::optional<Animation> animation;
+        uint64_t order;
+      };
+
+      struct Placed {
+        char32_t codepoint;
+        Glyph glyph;
+        // In the output
+        L2D::Rect rect;
+
+        friend auto operator==(Placed const & lhs, Placed const & rhs) {
+          return lhs.codepoint == rhs.codepoint && lhs.rect == rhs.rect;
+        }
+      };
+
+      // An element as it was drawn in a frame
+      struct Drawn {
+        Element look;
+        FT_Face face = nullptr;
+        uint64_t order = 0;
+        std::vector<Placed> glyphs;
+        // Empty when nothing shows
+        L2D::Rect bounds = {0, 0, 0, 0};
+      };
+
+      Fonts fonts;
+      std::string defaultFont;
+      std::map<std::string, Item> items;
+      uint64_t nextOrder = 0;
+      std::map<std::string, Drawn> drawn;
+      // Kept whole so any part of it can be drawn again and copied to the layer
+      L2D::FramePool::Frame canvas;
+      // The colour of a rect across a row, for Kernels::over
+      std::vector<uint8_t> span;
+
+      static constexpr auto canvasPitch = KeyFill::outputSize.w * 4;
+
+      static auto canvasRect() { return L2D::Rect{{0, 0}, KeyFill::outputSize}; }
+
+      auto fontFor(Element const & element) -> FT_Face {
+        return fonts.face(element.font.empty() ? defaultFont : element.font);
+      }
+
+      static auto content(Element const & element) -> std::string {
+        if (!element.clock.empty()) {
+          auto const now = SystemClock::to_time_t(SystemClock::now());
+          auto local = std::tm{};
+#ifdef _WIN32
+          localtime_s(&local, &now);
+#else
+          localtime_r(&now, &local);
+#endif
+          char text[256];
+          return {text, std::strftime(text, sizeof(text), element.clock.c_str(), &local)};
+        }
+        if (element.until) {
+          auto const left = std::max<int64_t>(std::chrono::ceil<std::chrono::seconds>(*element.until - SystemClock::now()).count(), 0);
+          return left >= 3600
+            ? fmt::format("{}:{:02}:{:02}", left / 3600, left / 60 % 60, left % 60)
+            : fmt::format("{}:{:02}", left / 60, left % 60);
+        }
+        return element.text;
+      }
+
+      // In the frame, part of the way through any animation
+      static auto look(Item const & item, uint64_t frame) -> Element {
+        auto const & animation = item.animation;
+        if (!animation || frame > animation->lastFrame()) {
+          return item.element;
+        }
+        if (frame < animation->firstFrame) {
+          return animation->from;
+        }
+        auto const t = KeyFill::ease(animation->transition.easing, static_cast<float>(frame - animation->firstFrame + 1) / animation->transition.frames);
+        auto const & from = animation->from;
+        auto look = item.element;
+        auto const between = [t](int a, int b) { return static_cast<int>(std::lround(lerp(a, b, t))); };
+        look.x = between(from.x, look.x);
+        look.y = between(from.y, look.y);
+        look.rect = lerp(from.rect, look.rect, t);
+        look.radius = between(from.radius, look.radius);
+        look.opacity = lerp(from.opacity, look.opacity, t);
+        look.colour = lerp(from.colour, look.colour, t);
+        return look;
+      }
+
+      auto layout(Element const & look, uint64_t order) -> Drawn {
+        auto result = Drawn{look, nullptr, order};
+        if (look.opacity <= 0 || look.colour.a == 0) {
+          return result;
+        }
+        auto const add = [&result](L2D::Rect rect) {
+          rect = rect & canvasRect();
+          if (!rect.empty()) {
+            result.bounds = result.bounds.empty() ? rect : result.bounds | rect;
+          }
+        };
+        if (look.kind == Element::Kind::Rect) {
+          add(look.rect);
+          return result;
+        }
+
+        auto const face = result.face = fontFor(look);
+        if (!face) {
+          return result;
+        }
+        auto const ascender = fonts.ascender(face, look.size);
+        auto const lineHeight = fonts.lineHeight(face, look.size);
+        auto const codepoints = decode(content(look));
+        auto baseline = look.y + ascender;
+        for (auto begin = codepoints.begin(); begin <= codepoints.end(); baseline += lineHeight) {
+          auto const end = std::find(begin, codepoints.end(), U'\n');
+          auto width = 0;
+          for (auto it = begin; it != end; ++it) {
+            width += fonts.glyph(face, look.size, *it).advance + (it != begin ? fonts.kerning(face, look.size, it[-1], *it) : 0);
+          }
+          auto pen = look.align == Align::Left ? look.x : look.align == Align::Centre ? look.x - width / 2 : look.x - width;
+          for (auto it = begin; it != end; ++it) {
+            if (it != begin) {
+              pen += fonts.kerning(face, look.size, it[-1], *it);
+            }
+            auto const glyph = fonts.glyph(face, look.size, *it);
+            if (!glyph.atlas.empty()) {
+              auto const rect = L2D::Rect{pen + glyph.left, baseline - glyph.top, glyph.atlas.w, glyph.atlas.h};
+              result.glyphs.push_back({*it, glyph, rect});
+              add(rect);
+            }
+            pen += glyph.advance;
+          }
+          if (end == codepoints.end()) {
+            break;
+          }
+          begin = end + 1;
+        }
+        return result;
+      }
+
+      // Everything but where the glyphs are
+      static auto sameLook(Drawn const & lhs, Drawn const & rhs) {
+        auto const & a = lhs.look;
+        auto const & b = rhs.look;
+        return lhs.order == rhs.order && lhs.face == rhs.face
+          && a.kind == b.kind && a.z == b.z && a.opacity == b.opacity
+          && a.colour.r == b.colour.r && a.colour.g == b.colour.g && a.colour.b == b.colour.b && a.colour.a == b.colour.a
+          && a.size == b.size && a.rect == b.rect && a.radius == b.radius;
+      }
+
+      // Premultiplied BGRA
+      static auto pixel(Element const & look) -> std::array<uint8_t, 4> {
+        auto const alpha = Kernels::Scalar::div255(look.colour.a * static_cast<uint32_t>(std::lround(std::clamp(look.opacity, 0.0f, 1.0f) * 255)));
+        return
+          { static_cast<uint8_t>(Kernels::Scalar::div255(look.colour.b * alpha))
+          , static_cast<uint8_t>(Kernels::Scalar::div255(look.colour.g * alpha))
+          , static_cast<uint8_t>(Kernels::Scalar::div255(look.colour.r * alpha))
+          , static_cast<uint8_t>(alpha)
+          };
+      }
+
+      // Of the pixel by the rect with its corners rounded, from 0 to 255
+      static auto coverage(L2D::Rect rect, int radius, int x, int y) -> uint32_t {
+        auto const px = x + 0.5f;
+        auto const py = y + 0.5f;
+        auto const r = static_cast<float>(radius);
+        auto const cx = std::clamp(px, rect.left() + r, rect.right() - r);
+        auto const cy = std::clamp(py, rect.top() + r, rect.bottom() - r);
+        auto const outside = std::hypot(px - cx, py - cy) - r;
+        return static_cast<uint32_t>(std::lround(std::clamp(0.5f - outside, 0.0f, 1.0f) * 255));
+      }
+
+      void draw(Drawn const & drawn, L2D::Rect clip) {
+        auto const colour = pixel(drawn.look);
+        auto const pixels = canvas.data();
+        if (drawn.look.kind == Element::Kind::Text) {
+          auto const & atlas = fonts.coverage();
+          for (auto const & placed : drawn.glyphs) {
+            auto const rect = placed.rect & clip;
+            for (auto y = rect.top(); y < rect.bottom(); ++y) {
+              auto const src = atlas.row(placed.glyph.atlas, y - placed.rect.y) + (rect.x - placed.rect.x);
+              auto const dst = pixels + y * canvasPitch + rect.x * 4;
+              for (auto x = 0; x < rect.w; ++x) {
+                if (src[x]) {
+                  Kernels::Scalar::over(dst + x * 4, colour.data(), 1, src[x]);
+                }
+              }
+            }
+          }
+          return;
+        }
+
+        auto const & shape = drawn.look.rect;
+        auto const rect = shape & clip;
+        auto const radius = std::clamp(drawn.look.radius, 0, std::min(shape.w, shape.h) / 2);
+        for (auto x = 0; x < rect.w; ++x) {
+          std::memcpy(span.data() + x * 4, colour.data(), 4);
+        }
+        for (auto y = rect.top(); y < rect.bottom(); ++y) {
+          auto const dst = pixels + y * canvasPitch + rect.x * 4;
+          if (y >= shape.top() + radius && y < shape.bottom() - radius) {
+            Kernels::over(dst, span.data(), rect.w, 255);
+            continue;
+          }
+          for (auto x = 0; x < rect.w; ++x) {
+            if (auto const c = coverage(shape, radius, rect.x + x, y)) {
+              Kernels::Scalar::over(dst + x * 4, colour.data(), 1, c);
+            }
+          }
+        }
+      }
+
+    public:
+      explicit Overlay(std::string defaultFont)
+        : defaultFont{std::move(defaultFont)}
+        , span(canvasPitch)
+        {}
+
+      auto element(std::string const & id) const -> std::optional<Element> {
+        auto it = items.find(id);
+        if (it == items.end()) {
+          return std::nullopt;
+        }
+        return it->second.element;
+      }
+
+      // Shown from the next frame, moving and fading from how it was with the
+      // transition, or fading in if it is new. False if its font can't be loaded.
+      auto set(std::string const & id, Element element, KeyFill::Transition transition, uint64_t frame) -> bool {
+        if (element.kind == Element::Kind::Text && !fontFor(element)) {
+          return false;
+        }
+        auto it = items.find(id);
+        auto animation = std::optional<Animation>{};
+        if (transition.kind != KeyFill::Transition::Kind::Cut && transition.frames > 0) {
+          auto from = element;
+          if (it == items.end()) {
+            from.opacity = 0;
+          } else {
+            from = look(it->second, frame);
+          }
+          animation = Animation{from, transition, frame + 1};
+        }
+        if (it == items.end()) {
+          items.emplace(id, Item{std::move(element), animation, nextOrder++});
+        } else {
+          it->second.element = std::move(element);
+          it->second.animation = animation;
+        }
+        return true;
+      }
+
+      auto remove(std::string const & id) -> bool {
+        return items.erase(id) > 0;
+      }
+
+      // Draws what changed into the layer, before each frame is rendered
+      void update(KeyFill::Windows & keyFill) {
+        auto const frame = keyFill.presentedFrames() + 1;
+        auto const generation = fonts.atlasGeneration();
+        auto now = std::map<std::string, Drawn>{};
+        for (auto & [id, item] : items) {
+          now.emplace(id, layout(look(item, frame), item.order));
+          if (item.animation && frame >= item.animation->lastFrame()) {
+            item.animation.reset();
+          }
+        }
+
+        auto damage = std::vector<L2D::Rect>{};
+        if (fonts.atlasGeneration() != generation) {
+          // The atlas filled up part way, the glyphs laid out before then aren't in it any more
+          for (auto & [id, drawn] : now) {
+            drawn = layout(drawn.look, drawn.order);
+          }
+          damage.push_back(canvasRect());
+        }
+        for (auto const & [id, before] : drawn) {
+          if (!now.count(id)) {
+            damage.push_back(before.bounds);
+          }
+        }
+        for (auto const & [id, after] : now) {
+          auto it = drawn.find(id);
+          if (it == drawn.end() || !sameLook(it->second, after)) {
+            if (it != drawn.end()) {
+              damage.push_back(it->second.bounds);
+            }
+            damage.push_back(after.bounds);
+            continue;
+          }
+          // The same text in the same place is left as it is
+          auto const & before = it->second.glyphs;
+          for (auto const & placed : before) {
+            if (std::find(after.glyphs.begin(), after.glyphs.end(), placed) == after.glyphs.end()) {
+              damage.push_back(placed.rect);
+            }
+          }
+          for (auto const & placed : after.glyphs) {
+            if (std::find(before.begin(), before.end(), placed) == before.end()) {
+              damage.push_back(placed.rect);
+            }
+          }
+        }
+        drawn = std::move(now);
+
+        for (auto & rect : damage) {
+          rect = rect & canvasRect();
+        }
+        damage.erase(std::remove_if(damage.begin(), damage.end(), [](auto rect) { return rect.empty(); }), damage.end());
+        if (damage.empty()) {
+          return;
+        }
+
+        if (!canvas) {
+          canvas = L2D::FramePool::shared().acquire(canvasPitch * KeyFill::outputSize.h);
+          std::memset(canvas.data(), 0, canvas.size());
+        }
+        auto stack = std::vector<Drawn const *>{};
+        for (auto const & [id, d] : drawn) {
+          stack.push_back(&d);
+        }
+        std::sort(stack.begin(), stack.end(), [](auto lhs, auto rhs) {
+          return std::pair{lhs->look.z, lhs->order} < std::pair{rhs->look.z, rhs->order};
+        });
+        // Rects that overlap are merged into one around them both, so no
+        // pixel is cleared, drawn or copied twice
+        for (auto merged = true; merged;) {
+          merged = false;
+          for (auto i = size_t{0}; i < damage.size() && !merged; ++i) {
+            for (auto j = i + 1; j < damage.size(); ++j) {
+              if (!(damage[i] & damage[j]).empty()) {
+                damage[i] = damage[i] | damage[j];
+                damage.erase(damage.begin() + j);
+                merged = true;
+                break;
+              }
+            }
+          }
+        }
+        for (auto const & rect : damage) {
+          for (auto y = rect.top(); y < rect.bottom(); ++y) {
+            std::memset(canvas.data() + y * canvasPitch + rect.x * 4, 0, static_cast<size_t>(rect.w) * 4);
+          }
+          for (auto d : stack) {
+            if (!(d->bounds & rect).empty()) {
+              draw(*d, rect);
+            }
+          }
+        }
+
+        auto dst = keyFill.lock(layerName, damage);
+        auto const pixels = static_cast<uint8_t*>(dst.pixels.get());
+        if (keyFill.compositesOnCPU()) {
+          for (auto const & rect : damage) {
+            for (auto y = rect.top(); y < rect.bottom(); ++y) {
+              std::memcpy(pixels + y * dst.pitch + rect.x * 4, canvas.data() + y * canvasPitch + rect.x * 4, static_cast<size_t>(rect.w) * 4);
+            }
+          }
+        } else {
+          // The texture has to be written whole
+          for (auto y = 0; y < KeyFill::outputSize.h; ++y) {
+            std::memcpy(pixels + y * dst.pitch, canvas.data() + y * canvasPitch, canvasPitch);
+          }
+        }
+        if (items.empty()) {
+          keyFill.hide(layerName);
+        }
+      }
+
+      auto json() const -> std::string {
+        auto const quote = [](std::string const & text) {
+          auto result = std::string{"\""};
+          for (auto c : text) {
+            if (c == '"' || c == '\\') {
+              result += '\\';
+              result += c;
+            } else if (static_cast<uint8_t>(c) < 0x20) {
+              result += fmt::format("\\u{:04x}", static_cast<int>(c));
+            } else {
+              result += c;
+            }
+          }
+          return result + '"';
+        };
+        auto result = std::string{R"({"elements":{)"};
+        for (auto const & [id, item] : items) {
+          auto const & e = item.element;
+          if (result.back() != '{') {
+            result += ',';
+          }
+          result += fmt::format
+            ( R"({}:{{"kind":"{}","z":{},"opacity":{},"colour":[{},{},{},{}],"in_transition":{},)"
+            , quote(id), e.kind == Element::Kind::Text ? "text" : "rect", e.z, e.opacity
+            , e.colour.r, e.colour.g, e.colour.b, e.colour.a, item.animation.has_value()
+            );
+          if (e.kind == Element::Kind::Text) {
+            result += fmt::format
+              ( R"("text":{},"font":{},"size":{},"x":{},"y":{},"align":"{}","clock":{},"countdown":{}}})"
+              , quote(content(e)), quote(e.font), e.size, e.x, e.y
+              , e.align == Align::Left ? "left" : e.align == Align::Centre ? "centre" : "right"
+              , e.clock.empty() ? "null" : quote(e.clock)
+              , e.until ? std::to_string(std::max<int64_t>(std::chrono::ceil<std::chrono::seconds>(*e.until - SystemClock::now()).count(), 0)) : "null"
+              );
+          } else {
+            result += fmt::format(R"("rect":[{},{},{},{}],"radius":{}}})", e.rect.x, e.rect.y, e.rect.w, e.rect.h, e.radius);
+          }
+        }
+        return result + fmt::format
+          ( R"(}},"glyphs":{{"cached":{},"rasterised":{}}}}})"
+          , fonts.cachedGlyphs(), fonts.rasterisedGlyphs()
+          );
+      }
+  };
+}
+
+#endif
@@ -0,0 +1,442 @@
+#ifndef PageBridge_hpp
+#define PageBridge_hpp
+
+#include "include/cef_app.h"
+#include "include/cef_parser.h"
+#include "include/cef_values.h"
+#include "include/wrapper/cef_message_router.h"
+
+#include "Scheme.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <fmt/core.h>
+
+// Named commands from the API to the page and acknowledgements back, over
+// the message router rather than synthetic key events.
+//
+// The page registers handlers with keyfill.on(name, handler), a handler may
+// return a promise and the command is acknowledged once it settles, so a page
+// can resolve when its animation has finished or a frame has been drawn,
+// keyfill.nextFrame() resolves once the next frame has been presented.
+//
+// Data pushed to the page is merged and delivered at most once per output
+// frame in a single process message, keyfill.data holds the latest values and
+// keyfill.onData(handler) is called with the changes and the full data.
+namespace PageBridge {
+  constexpr auto dataMessage = "keyfill.data";
+
+  inline auto config() {
+    auto config = CefMessageRouterConfig{};
+    config.js_query_function = "keyfillQuery";
+    config.js_cancel_function = "keyfillQueryCancel";
+    return config;
+  }
+
+  constexpr auto shim = R"js(
+    (() => {
+      const handlers = {};
+      const dataHandlers = [];
+      const data = {};
+      const ack = (id, ok, result) => window.keyfillQuery({
+        request: JSON.stringify({type: "ack", id, ok, result: result === undefined ? null : result}),
+      });
+      window.keyfill = {
+        on(name, handler) { handlers[name] = handler; },
+        nextFrame() {
+          return new Promise(resolve => requestAnimationFrame(() => requestAnimationFrame(resolve)));
+        },
+        data,
+        onData(handler) { dataHandlers.push(handler); },
+        _data(json) {
+          const changes = JSON.parse(json);
+          for (const [key, value] of Object.entries(changes)) {
+            if (value === null) {
+              delete data[key];
+            } else {
+              data[key] = value;
+            }
+          }
+          for (const handler of dataHandlers) {
+            handler(changes, data);
+          }
+        },
+      };
+      window.keyfillQuery({
+        request: JSON.stringify({type: "subscribe"}),
+        persistent: true,
+        onSuccess: message => {
+          const {id, name, payload} = JSON.parse(message);
+          const handler = handlers[name];
+          if (!handler) {
+            ack(id, false, "No handler for " + name);
+            return;
+          }
+          Promise.resolve()
+            .then(() => handler(payload))
+            .then(result => ack(id, true, result), error => ack(id, false, String(error)));
+        },
+        onFailure: () => {},
+      });
+    })();
+  )js";
+
+  // Used for the sub-processes, on macOS from the helper
+  class RendererApp : public CefApp, CefRenderProcessHandler {
+    IMPLEMENT_REFCOUNTING(RendererApp);
+
+    private:
+      CefRefPtr<CefMessageRouterRendererSide> router;
+
+    public:
+      // CefApp methods
+      void OnRegisterCustomSchemes(CefRawPtr<CefSchemeRegistrar> registrar) override {
+        Scheme::registerCustomScheme(registrar);
+      }
+
+      auto GetRenderProcessHandler() -> CefRefPtr<CefRenderProcessHandler> override {
+        return this;
+      }
+
+      // CefRenderProcessHandler methods
+      void OnWebKitInitialized() override {
+        router = CefMessageRouterRendererSide::Create(config());
+      }
+
+      void OnContextCreated
+        ( CefRefPtr<CefBrowser> browser
+        , CefRefPtr<CefFrame> frame
+        , CefRefPtr<CefV8Context> context
+        ) override {
+        router->OnContextCreated(browser, frame, context);
+        if (frame->IsMain()) {
+          auto retval = CefRefPtr<CefV8Value>{};
+          auto exception = CefRefPtr<CefV8Exception>{};
+          context->Eval(shim, frame->GetURL(), 0, retval, exception);
+        }
+      }
+
+      void OnContextReleased
+        ( CefRefPtr<CefBrowser> browser
+        , CefRefPtr<CefFrame> frame
+        , CefRefPtr<CefV8Context> context
+        ) override {
+        router->OnContextReleased(browser, frame, context);
+      }
+
+      auto OnProcessMessageReceived
+        ( CefRefPtr<CefBrowser> browser
+        , CefRefPtr<CefFrame> frame
+        , CefProcessId source_process
+        , CefRefPtr<CefProcessMessage> message
+        ) -> bool override {
+        if (message->GetName() == dataMessage) {
+          auto context = frame->GetV8Context();
+          if (context && context->Enter()) {
+            auto keyfill = context->GetGlobal()->GetValue("keyfill");
+            if (keyfill && keyfill->IsObject()) {
+              auto receive = keyfill->GetValue("_data");
+              if (receive && receive->IsFunction()) {
+                receive->ExecuteFunction(keyfill, {CefV8Value::CreateString(message->GetArgumentList()->GetString(0))});
+              }
+            }
+            context->Exit();
+          }
+          return true;
+        }
+        return router->OnProcessMessageReceived(browser, frame, source_process, message);
+      }
+  };
+
+  struct Ack {
+    enum class Status { Ok, Failed, TimedOut };
+
+    Status status;
+    // JSON
+    std::string result;
+    double latencyMs;
+  };
+
+  struct DataStats {
+    uint64_t updates = 0;
+    uint64_t deliveries = 0;
+    size_t keys = 0;
+    // From the first update in a delivery to sending it
+    double lastLatencyMs = 0;
+    double maxLatencyMs = 0;
+
+    auto json() const -> std::string {
+      return fmt::format
+        ( R"({{"updates":{},"deliveries":{},"keys":{},"last_latency_ms":{:.3f},"max_latency_ms":{:.3f}}})"
+        , updates, deliveries, keys, lastLatencyMs, maxLatencyMs
+        );
+    }
+  };
+
+  // The browser side, everything other than parsePayload, update and
+  // dataStats runs on the CEF UI thread
+  class Bridge : public CefMessageRouterBrowserSide::Handler {
+    private:
+      using Clock = std::chrono::steady_clock;
+
+      static constexpr auto timeout = std::chrono::seconds{5};
+
+      struct Pending {
+        std::function<void(Ack)> done;
+        Clock::time_point sent;
+        bool delivered;
+      };
+
+      CefRefPtr<CefMessageRouterBrowserSide> _router;
+
+      CefRefPtr<Callback> subscriber;
+      int64 subscriberQuery = 0;
+
+      int nextId = 1;
+      std::map<int, Pending> pending;
+      // Commands sent before the page has subscribed
+      std::vector<std::pair<int, std::string>> queued;
+
+      std::mutex dataMutex;
+      CefRefPtr<CefDictionaryValue> data = CefDictionaryValue::Create();
+      CefRefPtr<CefDictionaryValue> dataChanges = CefDictionaryValue::Create();
+      std::optional<Clock::time_point> firstChange;
+      DataStats stats;
+      // A new page needs all of the data rather than the changes
+      bool resync = false;
+      // Without the fragment, the data belongs to the page at this URL
+      std::string page;
+
+      static auto toJSON(CefRefPtr<CefValue> value) -> std::string {
+        return value ? CefWriteJSON(value, JSON_WRITER_DEFAULT).ToString() : "null";
+      }
+
+      void finish(int id, Ack::Status status, std::string result) {
+        auto it = pending.find(id);
+        if (it == pending.end()) {
+          return;
+        }
+        auto const latency = std::chrono::duration<double, std::milli>{Clock::now() - it->second.sent};
+        auto done = std::move(it->second.done);
+        pending.erase(it);
+        done(Ack{status, std::move(result), latency.count()});
+      }
+
+    public:
+      Bridge() = default;
+
+      Bridge(Bridge const &) = delete;
+      Bridge& operator=(Bridge const &) = delete;
+
+      // The router can only be made on the UI thread once CEF is initialized,
+      // before the browser is created
+      void start() {
+        _router = CefMessageRouterBrowserSide::Create(config());
+        _router->AddHandler(this, true);
+      }
+
+      auto router() -> CefRefPtr<CefMessageRouterBrowserSide> { return _router; }
+
+      // Returns nullptr if the payload isn't valid JSON, an empty payload is null
+      static auto parsePayload(std::string const & body) -> CefRefPtr<CefValue> {
+        if (body.empty()) {
+          auto value = CefValue::Create();
+          value->SetNull();
+          return value;
+        }
+        return CefParseJSON(body, JSON_PARSER_RFC);
+      }
+
+      void send(std::string const & name, CefRefPtr<CefValue> payload, std::function<void(Ack)> done) {
+        auto const id = nextId++;
+
+        auto command = CefDictionaryValue::Create();
+        command->SetInt("id", id);
+        command->SetString("name", name);
+        command->SetValue("payload", payload);
+        auto value = CefValue::Create();
+        value->SetDictionary(command);
+        auto message = toJSON(value);
+
+        pending.emplace(id, Pending{std::move(done), Clock::now(), static_cast<bool>(subscriber)});
+        if (subscriber) {
+          subscriber->Success(message);
+        } else {
+          queued.emplace_back(id, std::move(message));
+        }
+      }
+
+      // Merges values into the data for the page, null removes a key
+      void update(CefRefPtr<CefDictionaryValue> values) {
+        auto keys = CefDictionaryValue::KeyList{};
+        values->GetKeys(keys);
+
+        auto lock = std::unique_lock{dataMutex};
+        for (auto const & key : keys) {
+          if (values->GetType(key) == VTYPE_NULL) {
+            data->Remove(key);
+            dataChanges->SetNull(key);
+          } else {
+            data->SetValue(key, values->GetValue(key));
+            dataChanges->SetValue(key, values->GetValue(key));
+          }
+        }
+        if (!firstChange) {
+          firstChange = Clock::now();
+        }
+        stats.updates += 1;
+        stats.keys = data->GetSize();
+      }
+
+      // The data is for one page, navigating to a different URL clears it but
+      // a reload keeps it. Called as soon as the navigation is asked for, so
+      // data sent after that is kept for the new page.
+      void navigate(std::string url) {
+        // As Chromium will have it, "http://host" is "http://host/"
+        auto parts = CefURLParts{};
+        auto canonical = CefString{};
+        if (CefParseURL(url, parts) && CefCreateURL(parts, canonical)) {
+          url = canonical.ToString();
+        }
+        url = url.substr(0, url.find('#'));
+        auto lock = std::unique_lock{dataMutex};
+        if (url == page) {
+          return;
+        }
+        if (!page.empty()) {
+          data = CefDictionaryValue::Create();
+          dataChanges = CefDictionaryValue::Create();
+          firstChange = std::nullopt;
+          stats.keys = 0;
+        }
+        page = std::move(url);
+      }
+
+      auto dataStats() -> DataStats {
+        auto lock = std::unique_lock{dataMutex};
+        return stats;
+      }
+
+      // Called once per output frame, sends everything that has changed since the last call
+      void flush(CefRefPtr<CefBrowser> browser) {
+        if (!subscriber) {
+          return;
+        }
+
+        auto lock = std::unique_lock{dataMutex};
+        auto changes = resync ? data->Copy(false) : dataChanges;
+        resync = false;
+        if (changes->GetSize() == 0) {
+          return;
+        }
+        dataChanges = CefDictionaryValue::Create();
+        if (firstChange) {
+          auto const latency = std::chrono::duration<double, std::milli>{Clock::now() - *firstChange}.count();
+          stats.lastLatencyMs = latency;
+          stats.maxLatencyMs = std::max(stats.maxLatencyMs, latency);
+          firstChange = std::nullopt;
+        }
+        stats.deliveries += 1;
+        lock.unlock();
+
+        auto value = CefValue::Create();
+        value->SetDictionary(changes);
+        auto message = CefProcessMessage::Create(dataMessage);
+        message->GetArgumentList()->SetString(0, toJSON(value));
+        browser->GetMainFrame()->SendProcessMessage(PID_RENDERER, message);
+      }
+
+      // Fails commands that haven't been acknowledged in time
+      void expire() {
+        auto const now = Clock::now();
+        auto expired = std::vector<int>{};
+        for (auto const & [id, command] : pending) {
+          if (now - command.sent > timeout) {
+            expired.push_back(id);
+          }
+        }
+        for (auto id : expired) {
+          finish(id, Ack::Status::TimedOut, "null");
+        }
+      }
+
+      // CefMessageRouterBrowserSide::Handler methods
+      auto OnQuery
+        ( CefRefPtr<CefBrowser> browser
+        , CefRefPtr<CefFrame> frame
+        , int64 query_id
+        , CefString const & request
+        , bool persistent
+        , CefRefPtr<Callback> callback
+        ) -> bool override {
+        auto value = CefParseJSON(request, JSON_PARSER_RFC);
+        if (!value || value->GetType() != VTYPE_DICTIONARY) {
+          return false;
+        }
+        auto query = value->GetDictionary();
+        auto const type = query->GetString("type").ToString();
+
+        if (type == "subscribe" && persistent) {
+          subscriber = callback;
+          subscriberQuery = query_id;
+          {
+            auto lock = std::unique_lock{dataMutex};
+            resync = true;
+          }
+          for (auto const & [id, message] : queued) {
+            // Skip any that have timed out while waiting
+            auto it = pending.find(id);
+            if (it != pending.end()) {
+              it->second.delivered = true;
+              subscriber->Success(message);
+            }
+          }
+          queued.clear();
+          return true;
+        } else if (type == "ack") {
+          finish
+            ( query->GetInt("id")
+            , query->GetBool("ok") ? Ack::Status::Ok : Ack::Status::Failed
+            , toJSON(query->GetValue("result"))
+            );
+          callback->Success("");
+          return true;
+        } else {
+          return false;
+        }
+      }
+
+      void OnQueryCanceled
+        ( CefRefPtr<CefBrowser> browser
+        , CefRefPtr<CefFrame> frame
+        , int64 query_id
+        ) override {
+        if (query_id != subscriberQuery) {
+          return;
+        }
+        subscriber = nullptr;
+        subscriberQuery = 0;
+
+        // The page has gone so anything it was sent will never be acknowledged
+        auto lost = std::vector<int>{};
+        for (auto const & [id, command] : pending) {
+          if (command.delivered) {
+            lost.push_back(id);
+          }
+        }
+        for (auto id : lost) {
+          finish(id, Ack::Status::Failed, R"("Page unloaded")");
+        }
+      }
+  };
+}
+
+#endif
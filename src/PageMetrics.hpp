@@ -0,0 +1,258 @@
+#ifndef PageMetrics_hpp
+#define PageMetrics_hpp
+
+#include "include/cef_browser.h"
+#include "include/cef_devtools_message_observer.h"
+#include "include/cef_parser.h"
+#include "include/cef_registration.h"
+#include "include/cef_render_handler.h"
+#include "include/cef_values.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include <fmt/core.h>
+
+namespace PageMetrics {
+  // Installs a longtask observer in the page the first time it is evaluated
+  // and then returns, and resets, the long tasks seen since the last call.
+  constexpr auto longTaskProbe = R"js(
+    (() => {
+      if (!window.__keyfillLongTasks) {
+        const stats = window.__keyfillLongTasks = {count: 0, total: 0, max: 0};
+        try {
+          new PerformanceObserver(list => {
+            for (const entry of list.getEntries()) {
+              stats.count += 1;
+              stats.total += entry.duration;
+              stats.max = Math.max(stats.max, entry.duration);
+            }
+          }).observe({entryTypes: ["longtask"]});
+        } catch (e) {}
+      }
+      const stats = window.__keyfillLongTasks;
+      const result = {count: stats.count, total: stats.total, max: stats.max};
+      stats.count = 0;
+      stats.total = 0;
+      stats.max = 0;
+      return result;
+    })()
+  )js";
+
+  struct Snapshot {
+    bool valid = false;
+    uint64_t samples = 0;
+
+    // Measured on our side of OnPaint
+    double paintsPerSecond = 0;
+    double dirtyPixelsPerPaint = 0;
+
+    // From Performance.getMetrics
+    double jsHeapUsed = 0;
+    double jsHeapTotal = 0;
+    double nodes = 0;
+    double documents = 0;
+    double layoutsPerSecond = 0;
+    double recalcStylesPerSecond = 0;
+    // Seconds spent per second of page time, i.e. the fraction of the page's main thread
+    double layoutLoad = 0;
+    double recalcStyleLoad = 0;
+    double scriptLoad = 0;
+    double taskLoad = 0;
+
+    // From the longtask observer, over the last sample period
+    uint32_t longTasks = 0;
+    double longTaskTotalMs = 0;
+    double longTaskMaxMs = 0;
+
+    auto json() const -> std::string {
+      return fmt::format
+        ( R"({{"valid":{},"samples":{},"paints_per_second":{:.2f},"dirty_pixels_per_paint":{:.0f},)"
+          R"("js_heap_used":{:.0f},"js_heap_total":{:.0f},"nodes":{:.0f},"documents":{:.0f},)"
+          R"("layouts_per_second":{:.2f},"recalc_styles_per_second":{:.2f},)"
+          R"("layout_load":{:.4f},"recalc_style_load":{:.4f},"script_load":{:.4f},"task_load":{:.4f},)"
+          R"("long_tasks":{},"long_task_total_ms":{:.1f},"long_task_max_ms":{:.1f}}})"
+        , valid, samples, paintsPerSecond, dirtyPixelsPerPaint
+        , jsHeapUsed, jsHeapTotal, nodes, documents
+        , layoutsPerSecond, recalcStylesPerSecond
+        , layoutLoad, recalcStyleLoad, scriptLoad, taskLoad
+        , longTasks, longTaskTotalMs, longTaskMaxMs
+        );
+    }
+  };
+
+  // Samples a browser's performance through the DevTools protocol.
+  // attach, sample and the observer callbacks all run on the CEF UI thread,
+  // onPaint on whichever thread calls OnPaint and snapshot on any thread.
+  class Monitor : public CefDevToolsMessageObserver {
+    IMPLEMENT_REFCOUNTING(Monitor);
+
+    private:
+      using Clock = std::chrono::steady_clock;
+
+      CefRefPtr<CefRegistration> registration;
+      int metricsRequest = 0;
+      int longTaskRequest = 0;
+
+      std::map<std::string, double> previousMetrics;
+
+      std::mutex mutex;
+      Snapshot current;
+      uint64_t paints = 0;
+      uint64_t dirtyPixels = 0;
+      Clock::time_point lastSample = Clock::now();
+
+      static auto parse(void const * result, size_t result_size) -> CefRefPtr<CefDictionaryValue> {
+        auto value = CefParseJSON(result, result_size, JSON_PARSER_RFC);
+        if (!value || value->GetType() != VTYPE_DICTIONARY) {
+          return nullptr;
+        }
+        return value->GetDictionary();
+      }
+
+      void onMetrics(CefRefPtr<CefDictionaryValue> result) {
+        auto list = result->GetList("metrics");
+        if (!list) {
+          return;
+        }
+        auto metrics = std::map<std::string, double>{};
+        for (size_t i = 0; i < list->GetSize(); ++i) {
+          auto metric = list->GetDictionary(i);
+          if (metric) {
+            metrics[metric->GetString("name").ToString()] = metric->GetDouble("value");
+          }
+        }
+
+        auto const rate = [&](char const * name, double dt) {
+          auto const previous = previousMetrics.find(name);
+          if (previous == previousMetrics.end() || dt <= 0) {
+            return 0.0;
+          }
+          return std::max(0.0, metrics[name] - previous->second) / dt;
+        };
+        auto const dt =
+          previousMetrics.count("Timestamp")
+          ? metrics["Timestamp"] - previousMetrics["Timestamp"]
+          : 0.0;
+
+        auto lock = std::unique_lock{mutex};
+        current.jsHeapUsed = metrics["JSHeapUsedSize"];
+        current.jsHeapTotal = metrics["JSHeapTotalSize"];
+        current.nodes = metrics["Nodes"];
+        current.documents = metrics["Documents"];
+        current.layoutsPerSecond = rate("LayoutCount", dt);
+        current.recalcStylesPerSecond = rate("RecalcStyleCount", dt);
+        current.layoutLoad = rate("LayoutDuration", dt);
+        current.recalcStyleLoad = rate("RecalcStyleDuration", dt);
+        current.scriptLoad = rate("ScriptDuration", dt);
+        current.taskLoad = rate("TaskDuration", dt);
+        current.valid = dt > 0;
+        lock.unlock();
+
+        previousMetrics = std::move(metrics);
+      }
+
+      void onLongTasks(CefRefPtr<CefDictionaryValue> result) {
+        auto remoteObject = result->GetDictionary("result");
+        if (!remoteObject) {
+          return;
+        }
+        auto value = remoteObject->GetDictionary("value");
+        if (!value) {
+          return;
+        }
+        auto lock = std::unique_lock{mutex};
+        current.longTasks = static_cast<uint32_t>(value->GetDouble("count"));
+        current.longTaskTotalMs = value->GetDouble("total");
+        current.longTaskMaxMs = value->GetDouble("max");
+      }
+
+    public:
+      void attach(CefRefPtr<CefBrowser> browser) {
+        registration = browser->GetHost()->AddDevToolsMessageObserver(this);
+        browser->GetHost()->ExecuteDevToolsMethod(0, "Performance.enable", nullptr);
+      }
+
+      void detach() {
+        registration = nullptr;
+        previousMetrics.clear();
+        auto lock = std::unique_lock{mutex};
+        current = Snapshot{};
+      }
+
+      void sample(CefRefPtr<CefBrowser> browser) {
+        if (!registration) {
+          return;
+        }
+
+        auto host = browser->GetHost();
+        metricsRequest = host->ExecuteDevToolsMethod(0, "Performance.getMetrics", nullptr);
+
+        auto params = CefDictionaryValue::Create();
+        params->SetString("expression", longTaskProbe);
+        params->SetBool("returnByValue", true);
+        params->SetBool("silent", true);
+        longTaskRequest = host->ExecuteDevToolsMethod(0, "Runtime.evaluate", params);
+
+        auto const now = Clock::now();
+        auto lock = std::unique_lock{mutex};
+        auto const seconds = std::chrono::duration<double>{now - lastSample}.count();
+        current.paintsPerSecond = seconds > 0 ? paints / seconds : 0;
+        current.dirtyPixelsPerPaint = paints > 0 ? static_cast<double>(dirtyPixels) / paints : 0;
+        current.samples += 1;
+        paints = 0;
+        dirtyPixels = 0;
+        lastSample = now;
+      }
+
+      void onPaint(CefRenderHandler::RectList const & dirtyRects) {
+        auto area = uint64_t{0};
+        for (auto const & rect : dirtyRects) {
+          area += static_cast<uint64_t>(rect.width) * rect.height;
+        }
+        auto lock = std::unique_lock{mutex};
+        paints += 1;
+        dirtyPixels += area;
+      }
+
+      auto snapshot() -> Snapshot {
+        auto lock = std::unique_lock{mutex};
+        return current;
+      }
+
+      // CefDevToolsMessageObserver methods
+      void OnDevToolsMethodResult
+        ( CefRefPtr<CefBrowser> browser
+        , int message_id
+        , bool success
+        , void const * result
+        , size_t result_size
+        ) override {
+        if (message_id != metricsRequest && message_id != longTaskRequest) {
+          return;
+        }
+        if (!success) {
+          // The Performance domain is dropped when the renderer is swapped on navigation
+          if (message_id == metricsRequest) {
+            browser->GetHost()->ExecuteDevToolsMethod(0, "Performance.enable", nullptr);
+          }
+          return;
+        }
+        auto dictionary = parse(result, result_size);
+        if (!dictionary) {
+          return;
+        }
+        if (message_id == metricsRequest) {
+          onMetrics(dictionary);
+        } else {
+          onLongTasks(dictionary);
+        }
+      }
+  };
+}
+
+#endif
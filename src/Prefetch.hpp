@@ -0,0 +1,149 @@
+#ifndef Prefetch_hpp
+#define Prefetch_hpp
+
+#include "include/cef_parser.h"
+#include "include/cef_request.h"
+#include "include/cef_response.h"
+#include "include/cef_urlrequest.h"
+#include "include/cef_values.h"
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Fetches assets ahead of time so they are in the browser's disk cache
+// before a graphic first goes on air. The bodies are only counted, loading
+// them through the global request context is what puts them in the cache.
+namespace Prefetch {
+  enum class State { Pending, Warm, Failed };
+
+  struct Entry {
+    State state = State::Pending;
+    int httpStatus = 0;
+    int error = 0;
+    uint64_t bytes = 0;
+    bool fromCache = false;
+  };
+
+  class Prefetcher;
+
+  class RequestClient : public CefURLRequestClient {
+    IMPLEMENT_REFCOUNTING(RequestClient);
+
+    private:
+      Prefetcher& prefetcher;
+      std::string url;
+
+    public:
+      RequestClient(Prefetcher& prefetcher, std::string url)
+        : prefetcher{prefetcher}
+        , url{std::move(url)}
+        {}
+
+      // CefURLRequestClient methods
+      void OnRequestComplete(CefRefPtr<CefURLRequest> request) override;
+
+      void OnUploadProgress(CefRefPtr<CefURLRequest> request, int64 current, int64 total) override {}
+
+      void OnDownloadProgress(CefRefPtr<CefURLRequest> request, int64 current, int64 total) override {}
+
+      void OnDownloadData(CefRefPtr<CefURLRequest> request, void const * data, size_t data_length) override;
+
+      auto GetAuthCredentials
+        ( bool isProxy
+        , CefString const & host
+        , int port
+        , CefString const & realm
+        , CefString const & scheme
+        , CefRefPtr<CefAuthCallback> callback
+        ) -> bool override {
+        return false;
+      }
+  };
+
+  // start runs on the CEF UI thread, json on any thread
+  class Prefetcher {
+    private:
+      std::mutex mutex;
+      std::map<std::string, Entry> entries;
+      // Kept alive until they complete
+      std::map<std::string, CefRefPtr<CefURLRequest>> requests;
+
+      friend class RequestClient;
+
+    public:
+      void start(std::vector<std::string> const & urls) {
+        for (auto const & url : urls) {
+          {
+            auto lock = std::unique_lock{mutex};
+            if (requests.count(url)) {
+              continue;
+            }
+            entries[url] = Entry{};
+          }
+
+          auto request = CefRequest::Create();
+          request->SetURL(url);
+          request->SetMethod("GET");
+          auto urlRequest = CefURLRequest::Create(request, new RequestClient{*this, url}, nullptr);
+
+          auto lock = std::unique_lock{mutex};
+          if (urlRequest) {
+            requests[url] = urlRequest;
+          } else {
+            entries[url].state = State::Failed;
+          }
+        }
+      }
+
+      auto json() -> std::string {
+        auto list = CefListValue::Create();
+        {
+          auto lock = std::unique_lock{mutex};
+          for (auto const & [url, entry] : entries) {
+            auto item = CefDictionaryValue::Create();
+            item->SetString("url", url);
+            item->SetString
+              ( "state"
+              , entry.state == State::Pending ? "pending"
+              : entry.state == State::Warm ? "warm"
+              : "failed"
+              );
+            item->SetInt("http_status", entry.httpStatus);
+            item->SetInt("error", entry.error);
+            item->SetDouble("bytes", static_cast<double>(entry.bytes));
+            item->SetBool("from_cache", entry.fromCache);
+            list->SetDictionary(list->GetSize(), item);
+          }
+        }
+        auto value = CefValue::Create();
+        value->SetList(list);
+        return CefWriteJSON(value, JSON_WRITER_DEFAULT).ToString();
+      }
+  };
+
+  inline void RequestClient::OnRequestComplete(CefRefPtr<CefURLRequest> request) {
+    auto response = request->GetResponse();
+    auto const httpStatus = response ? response->GetStatus() : 0;
+
+    auto lock = std::unique_lock{prefetcher.mutex};
+    auto& entry = prefetcher.entries[url];
+    entry.httpStatus = httpStatus;
+    entry.error = request->GetRequestError();
+    entry.fromCache = request->ResponseWasCached();
+    entry.state =
+      request->GetRequestStatus() == UR_SUCCESS && httpStatus >= 200 && httpStatus < 300
+      ? State::Warm
+      : State::Failed;
+    prefetcher.requests.erase(url);
+  }
+
+  inline void RequestClient::OnDownloadData(CefRefPtr<CefURLRequest> request, void const * data, size_t data_length) {
+    auto lock = std::unique_lock{prefetcher.mutex};
+    prefetcher.entries[url].bytes += data_length;
+  }
+}
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef RenderThread_hpp
+#define RenderThread_hpp
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// A thread that runs one job at a time for the main loop, which starts the
+// jobs for every channel and then waits for all of them.
+namespace RenderThread {
+  class RenderThread {
+    private:
+      std::mutex mutex;
+      std::condition_variable cv;
+      std::function<void()> job;
+      bool stopping = false;
+
+      std::thread thread;
+
+      void run() {
+        auto lock = std::unique_lock{mutex};
+        while (true) {
+          cv.wait(lock, [this] { return job || stopping; });
+          if (!job) {
+            return;
+          }
+          lock.unlock();
+          job();
+          lock.lock();
+          job = nullptr;
+          cv.notify_all();
+        }
+      }
+
+    public:
+      RenderThread() : thread{[this] { run(); }} {}
+
+      RenderThread(RenderThread const &) = delete;
+      RenderThread& operator=(RenderThread const &) = delete;
+
+      ~RenderThread() {
+        {
+          auto lock = std::unique_lock{mutex};
+          cv.wait(lock, [this] { return !job; });
+          stopping = true;
+        }
+        cv.notify_all();
+        thread.join();
+      }
+
+      // Waits for the previous job first
+      void start(std::function<void()> f) {
+        auto lock = std::unique_lock{mutex};
+        cv.wait(lock, [this] { return !job; });
+        job = std::move(f);
+        cv.notify_all();
+      }
+
+      void wait() {
+        auto lock = std::unique_lock{mutex};
+        cv.wait(lock, [this] { return !job; });
+      }
+  };
+}
+
+#endif
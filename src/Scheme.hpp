@@ -0,0 +1,31 @@
+#ifndef Scheme_hpp
+#define Scheme_hpp
+
+#include "include/cef_scheme.h"
+
+// The keyfill:// scheme serves our own pages, videos and graphics bundles
+// inside the browser process, without going through the web server.
+// It has to be registered in every process, handlers are in SchemeHandler.hpp
+namespace Scheme {
+  constexpr auto name = "keyfill";
+
+  // Our pages and videos
+  constexpr auto appHost = "app";
+  constexpr auto app = "keyfill://app";
+
+  // Uploaded zip bundles, as keyfill://bundle/<name>/<path>
+  constexpr auto bundleHost = "bundle";
+  constexpr auto bundle = "keyfill://bundle";
+
+  inline void registerCustomScheme(CefRawPtr<CefSchemeRegistrar> registrar) {
+    registrar->AddCustomScheme
+      ( name
+      , CEF_SCHEME_OPTION_STANDARD
+      | CEF_SCHEME_OPTION_SECURE
+      | CEF_SCHEME_OPTION_CORS_ENABLED
+      | CEF_SCHEME_OPTION_FETCH_ENABLED
+      );
+  }
+}
+
+#endif
@@ -0,0 +1,417 @@
+#ifndef SchemeHandler_hpp
+#define SchemeHandler_hpp
+
+#include "include/cef_parser.h"
+#include "include/cef_resource_handler.h"
+#include "include/cef_scheme.h"
+#include "include/cef_stream.h"
+#include "include/cef_zip_reader.h"
+
+#include "Scheme.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+
+#include <fmt/core.h>
+
+#if defined(WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Scheme {
+  // A read only mapping of a whole file
+  class MappedFile {
+    private:
+      void const * _data = nullptr;
+      size_t _size = 0;
+#if defined(WIN32)
+      HANDLE file = INVALID_HANDLE_VALUE;
+      HANDLE mapping = nullptr;
+#endif
+
+      MappedFile() = default;
+
+    public:
+      MappedFile(MappedFile const &) = delete;
+      MappedFile& operator=(MappedFile const &) = delete;
+
+      static auto open(std::filesystem::path const & path) -> std::shared_ptr<MappedFile> {
+        auto mapped = std::shared_ptr<MappedFile>{new MappedFile{}};
+#if defined(WIN32)
+        mapped->file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (mapped->file == INVALID_HANDLE_VALUE) {
+          return nullptr;
+        }
+        auto size = LARGE_INTEGER{};
+        if (!GetFileSizeEx(mapped->file, &size)) {
+          return nullptr;
+        }
+        mapped->_size = static_cast<size_t>(size.QuadPart);
+        if (mapped->_size == 0) {
+          return mapped;
+        }
+        mapped->mapping = CreateFileMappingW(mapped->file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapped->mapping) {
+          return nullptr;
+        }
+        mapped->_data = MapViewOfFile(mapped->mapping, FILE_MAP_READ, 0, 0, 0);
+        if (!mapped->_data) {
+          return nullptr;
+        }
+#else
+        auto const fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+          return nullptr;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+          close(fd);
+          return nullptr;
+        }
+        mapped->_size = static_cast<size_t>(info.st_size);
+        if (mapped->_size != 0) {
+          auto data = mmap(nullptr, mapped->_size, PROT_READ, MAP_PRIVATE, fd, 0);
+          if (data == MAP_FAILED) {
+            close(fd);
+            return nullptr;
+          }
+          // Videos are mostly read front to back
+          madvise(data, mapped->_size, MADV_SEQUENTIAL);
+          mapped->_data = data;
+        }
+        close(fd);
+#endif
+        return mapped;
+      }
+
+      ~MappedFile() {
+#if defined(WIN32)
+        if (_data) {
+          UnmapViewOfFile(_data);
+        }
+        if (mapping) {
+          CloseHandle(mapping);
+        }
+        if (file != INVALID_HANDLE_VALUE) {
+          CloseHandle(file);
+        }
+#else
+        if (_data) {
+          munmap(const_cast<void*>(_data), _size);
+        }
+#endif
+      }
+
+      auto data() const { return static_cast<char const *>(_data); }
+      auto size() const { return _size; }
+  };
+
+  // Bytes to serve and whatever keeps them alive
+  struct Body {
+    std::shared_ptr<void const> owner;
+    char const * data;
+    size_t size;
+
+    static auto of(std::shared_ptr<std::string const> string) {
+      auto const data = string->data();
+      auto const size = string->size();
+      return Body{std::move(string), data, size};
+    }
+
+    static auto of(std::shared_ptr<MappedFile const> file) {
+      auto const data = file->data();
+      auto const size = file->size();
+      return Body{std::move(file), data, size};
+    }
+  };
+
+  // Returns the half open range requested by a Range header, only the first
+  // range of a multipart request is served
+  inline auto parseRange(std::string_view header, size_t size) -> std::optional<std::pair<size_t, size_t>> {
+    constexpr auto prefix = std::string_view{"bytes="};
+    if (header.substr(0, prefix.size()) != prefix) {
+      return std::nullopt;
+    }
+    header.remove_prefix(prefix.size());
+    header = header.substr(0, header.find(','));
+
+    auto const dash = header.find('-');
+    if (dash == std::string_view::npos) {
+      return std::nullopt;
+    }
+    auto const number = [](std::string_view digits) -> std::optional<size_t> {
+      if (digits.empty() || digits.find_first_not_of("0123456789") != std::string_view::npos) {
+        return std::nullopt;
+      }
+      return std::stoull(std::string{digits});
+    };
+    auto const first = number(header.substr(0, dash));
+    auto const last = number(header.substr(dash + 1));
+
+    if (first && last && *first <= *last && *first < size) {
+      return std::pair{*first, std::min(*last + 1, size)};
+    } else if (first && !last && dash + 1 == header.size() && *first < size) {
+      return std::pair{*first, size};
+    } else if (!first && dash == 0 && last && *last > 0 && size > 0) {
+      return std::pair{size - std::min(*last, size), size};
+    } else {
+      return std::nullopt;
+    }
+  }
+
+  // Serves a body from memory, with range requests so videos can seek
+  class ResourceHandler : public CefResourceHandler {
+    IMPLEMENT_REFCOUNTING(ResourceHandler);
+
+    private:
+      Body body;
+      std::string mimeType;
+      int status;
+
+      size_t begin = 0;
+      size_t end;
+      size_t position = 0;
+
+    public:
+      ResourceHandler(Body body, std::string mimeType, int status = 200)
+        : body{std::move(body)}
+        , mimeType{std::move(mimeType)}
+        , status{status}
+        , end{this->body.size}
+        {}
+
+      static auto notFound() -> CefRefPtr<ResourceHandler> {
+        static auto const message = std::make_shared<std::string const>("404 : Not Found");
+        return new ResourceHandler{Body::of(message), "text/html", 404};
+      }
+
+      // CefResourceHandler methods
+      auto Open(CefRefPtr<CefRequest> request, bool& handle_request, CefRefPtr<CefCallback> callback) -> bool override {
+        handle_request = true;
+        auto const range = request->GetHeaderByName("Range").ToString();
+        if (status == 200 && !range.empty()) {
+          if (auto const requested = parseRange(range, body.size)) {
+            std::tie(begin, end) = *requested;
+            status = 206;
+          } else {
+            begin = 0;
+            end = 0;
+            status = 416;
+          }
+        }
+        position = begin;
+        return true;
+      }
+
+      void GetResponseHeaders(CefRefPtr<CefResponse> response, int64& response_length, CefString& redirectUrl) override {
+        response->SetStatus(status);
+        response->SetMimeType(mimeType);
+        response->SetHeaderByName("Accept-Ranges", "bytes", true);
+        if (status == 206) {
+          response->SetHeaderByName("Content-Range", fmt::format("bytes {}-{}/{}", begin, end - 1, body.size), true);
+        } else if (status == 416) {
+          response->SetHeaderByName("Content-Range", fmt::format("bytes */{}", body.size), true);
+        }
+        response_length = static_cast<int64>(end - begin);
+      }
+
+      auto Skip(int64 bytes_to_skip, int64& bytes_skipped, CefRefPtr<CefResourceSkipCallback> callback) -> bool override {
+        auto const skipped = std::min(static_cast<size_t>(bytes_to_skip), end - position);
+        position += skipped;
+        bytes_skipped = static_cast<int64>(skipped);
+        return skipped > 0;
+      }
+
+      auto Read(void* data_out, int bytes_to_read, int& bytes_read, CefRefPtr<CefResourceReadCallback> callback) -> bool override {
+        auto const read = std::min(static_cast<size_t>(bytes_to_read), end - position);
+        std::memcpy(data_out, body.data + position, read);
+        position += read;
+        bytes_read = static_cast<int>(read);
+        return read > 0;
+      }
+
+      void Cancel() override {}
+  };
+
+  struct Page {
+    std::shared_ptr<std::string const> body;
+    std::string mimeType;
+  };
+
+  // Handles keyfill://app/ and keyfill://bundle/, created on the IO thread
+  class SchemeHandlerFactory : public CefSchemeHandlerFactory {
+    IMPLEMENT_REFCOUNTING(SchemeHandlerFactory);
+
+    private:
+      // Files in a bundle by path
+      using Bundle = std::map<std::string, std::shared_ptr<std::string const>>;
+
+      std::map<std::string, Page> pages;
+      std::filesystem::path videoDir;
+      std::filesystem::path bundleDir;
+
+      std::mutex mutex;
+      std::map<std::string, std::shared_ptr<Bundle const>> bundles;
+
+      static auto mimeTypeOf(std::string const & path) -> std::string {
+        auto extension = std::filesystem::path{path}.extension().string();
+        if (!extension.empty()) {
+          extension.erase(0, 1);
+        }
+        auto mimeType = CefGetMimeType(extension).ToString();
+        return mimeType.empty() ? "application/octet-stream" : mimeType;
+      }
+
+      static auto isPlainName(std::string const & name) {
+        return !name.empty() && name.find_first_of("/\\") == std::string::npos && name != "." && name != "..";
+      }
+
+      auto loadBundle(std::string const & name) -> std::shared_ptr<Bundle const> {
+        auto lock = std::unique_lock{mutex};
+        if (auto it = bundles.find(name); it != bundles.end()) {
+          return it->second;
+        }
+
+        auto stream = CefStreamReader::CreateForFile((bundleDir / (name + ".zip")).string());
+        if (!stream) {
+          return nullptr;
+        }
+        auto zip = CefZipReader::Create(stream);
+        if (!zip) {
+          return nullptr;
+        }
+
+        // Decompressed once, then served straight from memory
+        auto bundle = std::make_shared<Bundle>();
+        for (auto more = zip->MoveToFirstFile(); more; more = zip->MoveToNextFile()) {
+          auto const fileName = zip->GetFileName().ToString();
+          if (fileName.empty() || fileName.back() == '/' || !zip->OpenFile("")) {
+            continue;
+          }
+          auto contents = std::string(static_cast<size_t>(zip->GetFileSize()), '\0');
+          auto read = size_t{0};
+          while (read < contents.size()) {
+            auto const n = zip->ReadFile(contents.data() + read, contents.size() - read);
+            if (n <= 0) {
+              break;
+            }
+            read += n;
+          }
+          contents.resize(read);
+          zip->CloseFile();
+          (*bundle)["/" + fileName] = std::make_shared<std::string const>(std::move(contents));
+        }
+        zip->Close();
+
+        bundles[name] = bundle;
+        return bundle;
+      }
+
+      auto app(std::string const & path) -> CefRefPtr<CefResourceHandler> {
+        if (auto it = pages.find(path); it != pages.end()) {
+          return new ResourceHandler{Body::of(it->second.body), it->second.mimeType};
+        }
+
+        constexpr auto getVideo = std::string_view{"/get_video/"};
+        if (path.compare(0, getVideo.size(), getVideo) == 0) {
+          auto const filename = path.substr(getVideo.size());
+          if (!isPlainName(filename)) {
+            return ResourceHandler::notFound();
+          }
+          auto video = MappedFile::open(videoDir / filename);
+          if (!video) {
+            return ResourceHandler::notFound();
+          }
+          return new ResourceHandler{Body::of(std::shared_ptr<MappedFile const>{std::move(video)}), mimeTypeOf(filename)};
+        }
+
+        return ResourceHandler::notFound();
+      }
+
+      auto bundle(std::string const & path) -> CefRefPtr<CefResourceHandler> {
+        // /<name>/<path in bundle>
+        auto const slash = path.find('/', 1);
+        if (slash == std::string::npos) {
+          return ResourceHandler::notFound();
+        }
+        auto const name = path.substr(1, slash - 1);
+        if (!isPlainName(name)) {
+          return ResourceHandler::notFound();
+        }
+        auto const files = loadBundle(name);
+        if (!files) {
+          return ResourceHandler::notFound();
+        }
+        auto const file = files->find(path.substr(slash));
+        if (file == files->end()) {
+          return ResourceHandler::notFound();
+        }
+        return new ResourceHandler{Body::of(file->second), mimeTypeOf(file->first)};
+      }
+
+    public:
+      SchemeHandlerFactory
+        ( std::map<std::string, Page> pages
+        , std::filesystem::path videoDir
+        , std::filesystem::path bundleDir
+        )
+        : pages{std::move(pages)}
+        , videoDir{std::move(videoDir)}
+        , bundleDir{std::move(bundleDir)}
+        {}
+
+      // Call when a bundle has been replaced, may be called from any thread
+      void evict(std::string const & name) {
+        auto lock = std::unique_lock{mutex};
+        bundles.erase(name);
+      }
+
+      void registerFactories() {
+        CefRegisterSchemeHandlerFactory(name, appHost, this);
+        CefRegisterSchemeHandlerFactory(name, bundleHost, this);
+      }
+
+      // CefSchemeHandlerFactory methods
+      auto Create
+        ( CefRefPtr<CefBrowser> browser
+        , CefRefPtr<CefFrame> frame
+        , CefString const & scheme_name
+        , CefRefPtr<CefRequest> request
+        ) -> CefRefPtr<CefResourceHandler> override {
+        auto parts = CefURLParts{};
+        if (!CefParseURL(request->GetURL(), parts)) {
+          return ResourceHandler::notFound();
+        }
+        auto const host = CefString(&parts.host).ToString();
+        auto const path = CefURIDecode
+          ( CefString(&parts.path)
+          , true
+          , static_cast<cef_uri_unescape_rule_t>(UU_SPACES | UU_URL_SPECIAL_CHARS_EXCEPT_PATH_SEPARATORS)
+          ).ToString();
+
+        if (host == appHost) {
+          return app(path);
+        } else if (host == bundleHost) {
+          return bundle(path);
+        } else {
+          return ResourceHandler::notFound();
+        }
+      }
+  };
+}
+
+#endif
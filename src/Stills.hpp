@@ -0,0 +1,324 @@
+#ifndef Stills_hpp
+#define Stills_hpp
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+
+#include <fmt/core.h>
+
+#include "KeyFill.hpp"
+#include "Light2D.hpp"
+
+#ifdef WIN32
+#include <SDL_image.h>
+#else
+#include <SDL2/SDL_image.h>
+#endif
+
+// Still images for logo bugs and holding slates without a page. Each is
+// decoded once into premultiplied BGRA and kept up to a budget, the least
+// recently shown going first, and written once into a layer of its own on
+// each channel, so showing it again only changes the layer's visibility.
+namespace Stills {
+  // Big enough for any still, small enough to be a texture on any GPU
+  constexpr auto maxSize = 8192;
+
+  // Names are files in the stills directory
+  inline auto validName(std::string const & name) {
+    return !name.empty() && name != "." && name != ".." && name.find_first_of("/\\") == std::string::npos;
+  }
+
+  struct Image {
+    // Changes when the still is uploaded again, so layers of the old one are replaced
+    uint64_t version;
+    L2D::Surface surface;
+
+    auto bytes() const { return static_cast<size_t>(surface.pitch()) * surface.height(); }
+  };
+
+  // PNG, JPEG or WebP, with or without alpha. Palettes, colour keys and grey
+  // are converted by SDL.
+  inline auto decode(L2D::L2DWitness l2DWitness, void const * data, size_t size) -> std::optional<L2D::Surface> {
+    using SurfacePtr = std::unique_ptr<SDL_Surface, L2D::lambdaFor<SDL_FreeSurface>>;
+    auto const loaded = SurfacePtr{IMG_Load_RW(SDL_RWFromConstMem(data, static_cast<int>(size)), 1)};
+    if (!loaded || loaded->w > maxSize || loaded->h > maxSize) {
+      return std::nullopt;
+    }
+    auto const bgra = SurfacePtr{SDL_ConvertSurfaceFormat(loaded.get(), SDL_PIXELFORMAT_BGRA32, 0)};
+    if (!bgra) {
+      return std::nullopt;
+    }
+    auto surface = L2D::Surface{l2DWitness, {bgra->w, bgra->h}, L2D::Surface::Format::BGRA32};
+    for (auto y = 0; y < bgra->h; ++y) {
+      auto src = static_cast<uint8_t const *>(bgra->pixels) + y * bgra->pitch;
+      auto dst = surface.pixels() + y * surface.pitch();
+      for (auto x = 0; x < bgra->w; ++x, src += 4, dst += 4) {
+        auto const a = src[3];
+        dst[0] = static_cast<uint8_t>((src[0] * a + 127) / 255);
+        dst[1] = static_cast<uint8_t>((src[1] * a + 127) / 255);
+        dst[2] = static_cast<uint8_t>((src[2] * a + 127) / 255);
+        dst[3] = a;
+      }
+    }
+    return surface;
+  }
+
+  // Shared by the channels and the web server's threads. Images are decoded
+  // outside the lock, and whoever has one keeps it after it is evicted.
+  class Cache {
+    public:
+      struct Statistics {
+        uint64_t hits = 0;
+        // Decoded again from the file
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+      };
+
+    private:
+      L2D::L2DWitness l2DWitness;
+      std::filesystem::path directory;
+      mutable std::mutex mutex;
+      size_t budget;
+      size_t bytes = 0;
+      // Most recently shown first
+      std::list<std::pair<std::string, std::shared_ptr<Image const>>> recent;
+      std::map<std::string, decltype(recent)::iterator> byName;
+      // Kept while a still is evicted, its file hasn't changed
+      std::map<std::string, uint64_t> versions;
+      uint64_t nextVersion = 1;
+      Statistics statistics;
+
+      auto path(std::string const & name) const { return directory / name; }
+
+      // The one just added always stays, even over the budget
+      void evict() {
+        while (bytes > budget && recent.size() > 1) {
+          bytes -= recent.back().second->bytes();
+          byName.erase(recent.back().first);
+          recent.pop_back();
+          statistics.evictions += 1;
+        }
+      }
+
+      void insert(std::string const & name, std::shared_ptr<Image const> image) {
+        if (auto it = byName.find(name); it != byName.end()) {
+          bytes -= it->second->second->bytes();
+          recent.erase(it->second);
+        }
+        recent.emplace_front(name, image);
+        byName[name] = recent.begin();
+        bytes += image->bytes();
+        evict();
+      }
+
+      auto decode(std::string const & data, uint64_t version) const -> std::shared_ptr<Image const> {
+        auto surface = Stills::decode(l2DWitness, data.data(), data.size());
+        if (!surface) {
+          return nullptr;
+        }
+        return std::make_shared<Image const>(Image{version, std::move(*surface)});
+      }
+
+    public:
+      // The loaders are set up here so that decoding on other threads
+      // doesn't race to do it
+      Cache(L2D::L2DInit & l2DInit, std::filesystem::path directory, size_t budget)
+        : l2DWitness{l2DInit}
+        , directory{std::move(directory)}
+        , budget{budget}
+        {
+        IMG_Init(IMG_INIT_PNG | IMG_INIT_JPG | IMG_INIT_WEBP);
+      }
+
+      Cache(Cache const &) = delete;
+      Cache& operator=(Cache const &) = delete;
+
+      ~Cache() { IMG_Quit(); }
+
+      // Decodes it and saves the file, replacing any still with the same
+      // name. Empty if it isn't an image or can't be saved.
+      auto add(std::string const & name, std::string const & data) -> std::shared_ptr<Image const> {
+        if (!validName(name)) {
+          return nullptr;
+        }
+        auto version = uint64_t{0};
+        {
+          auto lock = std::lock_guard{mutex};
+          version = nextVersion++;
+        }
+        auto image = decode(data, version);
+        if (!image) {
+          return nullptr;
+        }
+        auto ec = std::error_code{};
+        std::filesystem::create_directories(directory, ec);
+        if (ec) {
+          return nullptr;
+        }
+        {
+          auto f = std::ofstream{path(name), std::ios::binary};
+          if (!f.write(data.data(), data.size())) {
+            return nullptr;
+          }
+        }
+        auto lock = std::lock_guard{mutex};
+        versions[name] = version;
+        insert(name, image);
+        return image;
+      }
+
+      // From memory, or decoded again from its file. Empty if there is no such still.
+      auto get(std::string const & name) -> std::shared_ptr<Image const> {
+        if (!validName(name)) {
+          return nullptr;
+        }
+        auto version = uint64_t{0};
+        {
+          auto lock = std::lock_guard{mutex};
+          if (auto it = byName.find(name); it != byName.end()) {
+            recent.splice(recent.begin(), recent, it->second);
+            statistics.hits += 1;
+            return it->second->second;
+          }
+          auto [known, inserted] = versions.try_emplace(name, nextVersion);
+          if (inserted) {
+            nextVersion += 1;
+          }
+          version = known->second;
+        }
+        auto f = std::ifstream{path(name), std::ios::binary};
+        if (!f) {
+          return nullptr;
+        }
+        auto image = decode(std::string{std::istreambuf_iterator<char>{f}, {}}, version);
+        if (!image) {
+          return nullptr;
+        }
+        auto lock = std::lock_guard{mutex};
+        statistics.misses += 1;
+        // Another thread may have decoded it or a new one may have been uploaded meanwhile
+        if (auto it = byName.find(name); it != byName.end()) {
+          return it->second->second;
+        }
+        if (versions[name] == version) {
+          insert(name, image);
+        }
+        return image;
+      }
+
+      // Whether this version is still cached, layers of any other can go
+      auto cached(std::string const & name, uint64_t version) const -> bool {
+        auto lock = std::lock_guard{mutex};
+        auto it = byName.find(name);
+        return it != byName.end() && it->second->second->version == version;
+      }
+
+      // And its file
+      auto remove(std::string const & name) -> bool {
+        if (!validName(name)) {
+          return false;
+        }
+        auto lock = std::lock_guard{mutex};
+        if (auto it = byName.find(name); it != byName.end()) {
+          bytes -= it->second->second->bytes();
+          recent.erase(it->second);
+          byName.erase(it);
+        }
+        versions.erase(name);
+        auto ec = std::error_code{};
+        return std::filesystem::remove(path(name), ec);
+      }
+
+      void setBudget(size_t budget) {
+        auto lock = std::lock_guard{mutex};
+        this->budget = budget;
+        evict();
+      }
+
+      auto json() const -> std::string {
+        auto lock = std::lock_guard{mutex};
+        auto stills = std::string{};
+        for (auto const & [name, image] : recent) {
+          stills += fmt::format
+            ( R"({}{{"name":"{}","width":{},"height":{},"bytes":{}}})"
+            , stills.empty() ? "" : ",", name
+            , image->surface.width(), image->surface.height(), image->bytes()
+            );
+        }
+        return fmt::format
+          ( R"({{"budget_bytes":{},"bytes":{},"hits":{},"misses":{},"evictions":{},"stills":[{}]}})"
+          , budget, bytes, statistics.hits, statistics.misses, statistics.evictions, stills
+          );
+      }
+  };
+
+  // A channel's stills, each in a layer "still:<name>" written once from the
+  // cache. Only the UI thread uses it.
+  class Layers {
+    private:
+      // What is in each layer
+      std::map<std::string, uint64_t> versions;
+
+    public:
+      static auto layerName(std::string const & name) { return "still:" + name; }
+
+      // Writes the image into its layer if it isn't there already, a new layer
+      // goes on top and is hidden until it is shown. Where the layer was and
+      // how it looked are kept when a new version replaces it.
+      void prepare(KeyFill::Windows & keyFill, std::string const & name, Image const & image) {
+        auto const layer = layerName(name);
+        auto properties = keyFill.layer(layer);
+        if (properties && versions[name] == image.version) {
+          return;
+        }
+        auto const size = L2D::Size{image.surface.width(), image.surface.height()};
+        if (properties) {
+          keyFill.removeLayer(layer);
+        } else {
+          properties = KeyFill::LayerProperties{keyFill.topZ(), false};
+          // Unscaled in the top left unless it fills the output
+          if (size.w != KeyFill::outputSize.w || size.h != KeyFill::outputSize.h) {
+            properties->dst = L2D::Rect{{0, 0}, size};
+          }
+        }
+        keyFill.addLayer(layer, *properties, size);
+        auto dst = keyFill.lock(layer);
+        for (auto y = 0; y < size.h; ++y) {
+          std::memcpy
+            ( static_cast<uint8_t*>(dst.pixels.get()) + y * dst.pitch
+            , image.surface.pixels() + y * image.surface.pitch()
+            , size.w * 4
+            );
+        }
+        versions[name] = image.version;
+      }
+
+      // Layers of stills that have left the cache go once they are no longer
+      // drawn, so the budget holds apart from what is on air
+      void prune(KeyFill::Windows & keyFill, Cache const & cache) {
+        for (auto it = versions.begin(); it != versions.end();) {
+          auto const layer = layerName(it->first);
+          if (!keyFill.layer(layer)) {
+            it = versions.erase(it);
+          } else if (!keyFill.drawn(layer) && !cache.cached(it->first, it->second)) {
+            keyFill.removeLayer(layer);
+            it = versions.erase(it);
+          } else {
+            ++it;
+          }
+        }
+      }
+  };
+}
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef ThreadPool_hpp
+#define ThreadPool_hpp
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Splits loops across threads. Any number of threads can run loops at once,
+// for example one per channel, and share the pool.
+namespace ThreadPool {
+  class ThreadPool {
+    private:
+      struct Loop {
+        std::function<void(size_t)> const & f;
+        size_t count;
+        // Iterations started and finished
+        size_t next = 0;
+        size_t done = 0;
+      };
+
+      std::mutex mutex;
+      std::condition_variable work;
+      std::condition_variable finished;
+      // Loops with iterations not yet started
+      std::deque<Loop*> loops;
+      bool stopping = false;
+
+      std::vector<std::thread> threads;
+
+      // Called and returns with the lock held
+      void runIterations(std::unique_lock<std::mutex>& lock, Loop& loop) {
+        while (loop.next < loop.count) {
+          auto const i = loop.next++;
+          if (loop.next == loop.count) {
+            loops.erase(std::find(loops.begin(), loops.end(), &loop));
+          }
+          lock.unlock();
+          loop.f(i);
+          lock.lock();
+          if (++loop.done == loop.count) {
+            finished.notify_all();
+          }
+        }
+      }
+
+      void run() {
+        auto lock = std::unique_lock{mutex};
+        while (true) {
+          work.wait(lock, [this] { return !loops.empty() || stopping; });
+          if (loops.empty()) {
+            return;
+          }
+          runIterations(lock, *loops.front());
+        }
+      }
+
+    public:
+      explicit ThreadPool(size_t size) {
+        for (size_t i = 0; i < size; ++i) {
+          threads.emplace_back([this] { run(); });
+        }
+      }
+
+      ThreadPool(ThreadPool const &) = delete;
+      ThreadPool& operator=(ThreadPool const &) = delete;
+
+      ~ThreadPool() {
+        {
+          auto lock = std::unique_lock{mutex};
+          stopping = true;
+        }
+        work.notify_all();
+        for (auto& thread : threads) {
+          thread.join();
+        }
+      }
+
+      auto size() const { return threads.size(); }
+
+      // Calls f with 0 to count - 1, in any order and some on this thread,
+      // and returns once they have all finished
+      void forEach(size_t count, std::function<void(size_t)> const & f) {
+        if (count == 0) {
+          return;
+        }
+        auto loop = Loop{f, count};
+        auto lock = std::unique_lock{mutex};
+        loops.push_back(&loop);
+        work.notify_all();
+        runIterations(lock, loop);
+        finished.wait(lock, [&loop] { return loop.done == loop.count; });
+      }
+
+      // One thread per core, counting the ones that call forEach
+      static auto shared() -> ThreadPool& {
+        static auto pool = ThreadPool{std::max(std::thread::hardware_concurrency(), 2u) - 1};
+        return pool;
+      }
+  };
+}
+
+#endif
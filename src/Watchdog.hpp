@@ -0,0 +1,324 @@
+#ifndef Watchdog_hpp
+#define Watchdog_hpp
+
+#include "include/cef_browser.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fmt/core.h>
+
+#if defined(__linux__)
+#include <filesystem>
+#include <sstream>
+#include <unistd.h>
+#elif defined(__APPLE__)
+#include <libproc.h>
+#include <unistd.h>
+#elif defined(WIN32)
+#include <windows.h>
+#include <psapi.h>
+#include <tlhelp32.h>
+#endif
+
+namespace Watchdog {
+  // Resident memory of the renderer processes belonging to this process.
+  // On Windows the renderers can't be told apart from the other helpers
+  // without reading their command lines, so all child processes are counted.
+  inline auto rendererResidentBytes() -> std::optional<uint64_t> {
+#if defined(__linux__)
+    // Renderers are forked from the zygote so are grandchildren, walk all descendants
+    auto parents = std::vector<std::pair<pid_t, pid_t>>{};
+    auto ec = std::error_code{};
+    for (auto const & entry : std::filesystem::directory_iterator{"/proc", ec}) {
+      auto const name = entry.path().filename().string();
+      if (name.find_first_not_of("0123456789") != std::string::npos) {
+        continue;
+      }
+      auto stat = std::ifstream{entry.path() / "stat"};
+      auto line = std::string{};
+      if (!std::getline(stat, line)) {
+        continue;
+      }
+      // The command name may contain spaces and parentheses, so skip to the last ')'
+      auto const close = line.rfind(')');
+      if (close == std::string::npos) {
+        continue;
+      }
+      auto fields = std::istringstream{line.substr(close + 1)};
+      auto state = std::string{};
+      auto ppid = pid_t{};
+      fields >> state >> ppid;
+      parents.emplace_back(std::stoi(name), ppid);
+    }
+    if (ec) {
+      return std::nullopt;
+    }
+
+    auto descendants = std::vector<pid_t>{getpid()};
+    for (size_t i = 0; i < descendants.size(); ++i) {
+      for (auto [pid, ppid] : parents) {
+        if (ppid == descendants[i]) {
+          descendants.push_back(pid);
+        }
+      }
+    }
+
+    auto const pageSize = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    auto total = uint64_t{0};
+    for (auto pid : descendants) {
+      auto const dir = std::filesystem::path{"/proc"} / std::to_string(pid);
+      auto cmdlineFile = std::ifstream{dir / "cmdline", std::ios::binary};
+      auto cmdline = std::string(std::istreambuf_iterator<char>{cmdlineFile}, std::istreambuf_iterator<char>{});
+      if (cmdline.find("--type=renderer") == std::string::npos) {
+        continue;
+      }
+      auto statm = std::ifstream{dir / "statm"};
+      auto size = uint64_t{};
+      auto resident = uint64_t{};
+      if (statm >> size >> resident) {
+        total += resident * pageSize;
+      }
+    }
+    return total;
+#elif defined(__APPLE__)
+    auto pids = std::vector<pid_t>(256);
+    auto const count = proc_listchildpids(getpid(), pids.data(), static_cast<int>(pids.size() * sizeof(pid_t)));
+    if (count < 0) {
+      return std::nullopt;
+    }
+    pids.resize(count);
+
+    auto total = uint64_t{0};
+    for (auto pid : pids) {
+      char path[PROC_PIDPATHINFO_MAXSIZE];
+      if (proc_pidpath(pid, path, sizeof(path)) <= 0 || std::string_view{path}.find("(Renderer)") == std::string_view::npos) {
+        continue;
+      }
+      auto info = proc_taskinfo{};
+      if (proc_pidinfo(pid, PROC_PIDTASKINFO, 0, &info, sizeof(info)) == sizeof(info)) {
+        total += info.pti_resident_size;
+      }
+    }
+    return total;
+#elif defined(WIN32)
+    auto snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+    if (snapshot == INVALID_HANDLE_VALUE) {
+      return std::nullopt;
+    }
+
+    auto const self = GetCurrentProcessId();
+    auto total = uint64_t{0};
+    auto entry = PROCESSENTRY32{};
+    entry.dwSize = sizeof(entry);
+    for (auto more = Process32First(snapshot, &entry); more; more = Process32Next(snapshot, &entry)) {
+      if (entry.th32ParentProcessID != self) {
+        continue;
+      }
+      auto process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, false, entry.th32ProcessID);
+      if (!process) {
+        continue;
+      }
+      auto counters = PROCESS_MEMORY_COUNTERS{};
+      if (GetProcessMemoryInfo(process, &counters, sizeof(counters))) {
+        total += counters.WorkingSetSize;
+      }
+      CloseHandle(process);
+    }
+    CloseHandle(snapshot);
+    return total;
+#else
+    return std::nullopt;
+#endif
+  }
+
+  struct Limits {
+    // 0 disables the limit
+    uint64_t rendererResidentBytes = 0;
+    uint64_t jsHeapBytes = 0;
+  };
+
+  struct Status {
+    Limits limits;
+    std::optional<uint64_t> rendererResidentBytes;
+    uint64_t jsHeapBytes = 0;
+    bool reloadPending = false;
+    uint64_t reloads = 0;
+    // Seconds until another reload is allowed, after one that left the page over its limits
+    int backoff = 0;
+    // Signed, a reload may not reclaim anything
+    int64_t lastReclaimedResidentBytes = 0;
+    int64_t lastReclaimedJsHeapBytes = 0;
+
+    auto json() const -> std::string {
+      return fmt::format
+        ( R"({{"renderer_rss_limit":{},"js_heap_limit":{},"renderer_rss":{},"js_heap":{},)"
+          R"("reload_pending":{},"reloads":{},"backoff_seconds":{},"last_reclaimed_rss":{},"last_reclaimed_js_heap":{}}})"
+        , limits.rendererResidentBytes, limits.jsHeapBytes
+        , rendererResidentBytes ? std::to_string(*rendererResidentBytes) : std::string{"null"}, jsHeapBytes
+        , reloadPending, reloads, backoff, lastReclaimedResidentBytes, lastReclaimedJsHeapBytes
+        );
+    }
+  };
+
+  // Reloads a page that has grown past its memory limits, but only while it
+  // is off air, and reports how much memory the reload gave back. A page
+  // that is still over its limits after a reload waits twice as long before
+  // the next, so one that needs more than the limit isn't reloaded forever.
+  // The resident memory is of all of the renderers, so which page it is
+  // reloaded for is picked by check below. Its own methods may be called from
+  // any thread.
+  class Watchdog {
+    private:
+      // Samples to wait after a reload before measuring what it reclaimed
+      static constexpr auto settleSamples = 5;
+      // Samples are a second apart, a minute after the first failed reload and at most an hour
+      static constexpr auto firstBackoffSamples = 60;
+      static constexpr auto maxBackoffSamples = 3600;
+
+      std::string limitsPath;
+
+      std::mutex mutex;
+      Status status;
+
+      std::optional<uint64_t> residentBeforeReload;
+      uint64_t jsHeapBeforeReload = 0;
+      int settling = 0;
+      int nextBackoff = firstBackoffSamples;
+
+      auto overResident() const {
+        auto const & resident = status.rendererResidentBytes;
+        return status.limits.rendererResidentBytes != 0 && resident && *resident > status.limits.rendererResidentBytes;
+      }
+
+      auto overJsHeap() const {
+        return status.limits.jsHeapBytes != 0 && status.jsHeapBytes > status.limits.jsHeapBytes;
+      }
+
+      // Not waiting for a reload or after one
+      auto idle() const { return !status.reloadPending && settling == 0; }
+
+    public:
+      Watchdog(std::string limitsPath) : limitsPath{std::move(limitsPath)} {
+        auto limitsFile = std::ifstream{this->limitsPath};
+        limitsFile >> status.limits.rendererResidentBytes >> status.limits.jsHeapBytes;
+      }
+
+      void setLimits(Limits limits) {
+        auto lock = std::unique_lock{mutex};
+        status.limits = limits;
+        // New limits get a new chance
+        status.backoff = 0;
+        nextBackoff = firstBackoffSamples;
+        auto limitsFile = std::ofstream{limitsPath};
+        limitsFile << limits.rendererResidentBytes << ' ' << limits.jsHeapBytes;
+      }
+
+      auto snapshot() -> Status {
+        auto lock = std::unique_lock{mutex};
+        return status;
+      }
+
+      // Once a second, measures what a reload gave back once it has settled
+      // and schedules one for the JS heap, which is the page's own
+      void sample(std::optional<uint64_t> resident, uint64_t jsHeapBytes) {
+        auto lock = std::unique_lock{mutex};
+        status.rendererResidentBytes = resident;
+        status.jsHeapBytes = jsHeapBytes;
+
+        if (status.backoff > 0) {
+          status.backoff -= 1;
+        }
+        if (settling > 0 && --settling == 0) {
+          if (residentBeforeReload && resident) {
+            status.lastReclaimedResidentBytes = static_cast<int64_t>(*residentBeforeReload) - static_cast<int64_t>(*resident);
+          }
+          status.lastReclaimedJsHeapBytes = static_cast<int64_t>(jsHeapBeforeReload) - static_cast<int64_t>(jsHeapBytes);
+          if (overResident() || overJsHeap()) {
+            status.backoff = nextBackoff;
+            nextBackoff = std::min(nextBackoff * 2, maxBackoffSamples);
+          } else {
+            nextBackoff = firstBackoffSamples;
+          }
+        }
+
+        if (idle() && status.backoff == 0 && overJsHeap()) {
+          status.reloadPending = true;
+        }
+      }
+
+      auto busy() -> bool {
+        auto lock = std::unique_lock{mutex};
+        return !idle();
+      }
+
+      // Whether the renderers are over this page's resident limit and it may be reloaded for it
+      auto overResidentLimit() -> bool {
+        auto lock = std::unique_lock{mutex};
+        return idle() && status.backoff == 0 && overResident();
+      }
+
+      void scheduleReload() {
+        auto lock = std::unique_lock{mutex};
+        status.reloadPending = true;
+      }
+
+      // A scheduled reload waits until the page is off air
+      void reloadOffAir(CefRefPtr<CefBrowser> browser, bool onAir) {
+        auto lock = std::unique_lock{mutex};
+        if (status.reloadPending && !onAir) {
+          residentBeforeReload = status.rendererResidentBytes;
+          jsHeapBeforeReload = status.jsHeapBytes;
+          settling = settleSamples;
+          status.reloadPending = false;
+          status.reloads += 1;
+          browser->Reload();
+        }
+      }
+  };
+
+  struct Page {
+    Watchdog & watchdog;
+    CefRefPtr<CefBrowser> browser;
+    uint64_t jsHeapBytes;
+    bool onAir;
+  };
+
+  // Every channel's page once a second on the CEF UI thread. The renderers
+  // are measured once for all of them, and while they are over the resident
+  // limits only one page is reloaded at a time, the one off air with the
+  // largest JS heap, so one heavy page doesn't reload all of the others and
+  // what each reload gave back is known before the next. A page on air isn't
+  // picked, it would hold up the others until it was cleared.
+  inline void check(std::vector<Page> const & pages) {
+    auto const resident = rendererResidentBytes();
+    for (auto const & page : pages) {
+      page.watchdog.sample(resident, page.jsHeapBytes);
+    }
+    auto const busy = std::any_of(pages.begin(), pages.end(), [](auto const & page) { return page.watchdog.busy(); });
+    if (!busy) {
+      auto heaviest = static_cast<Page const *>(nullptr);
+      for (auto const & page : pages) {
+        if (!page.onAir && page.watchdog.overResidentLimit() && (!heaviest || page.jsHeapBytes > heaviest->jsHeapBytes)) {
+          heaviest = &page;
+        }
+      }
+      if (heaviest) {
+        heaviest->watchdog.scheduleReload();
+      }
+    }
+    for (auto const & page : pages) {
+      page.watchdog.reloadOffAir(page.browser, page.onAir);
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,81 @@
+// An example consumer of the shared memory output. Prints how many frames it
+// read each second, how old they were when it got them and how much of the
+// output the key covers.
+//
+//   frame_ring_reader [name]
+
+#include "FrameRing.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+
+auto main(int argc, char **argv) -> int {
+  auto const name = std::string{argc > 1 ? argv[1] : "/keyfillwebview"};
+
+  auto reader = FrameRing::Reader::open(name);
+  if (!reader) {
+    std::cerr << "No frame ring called " << name << "\n";
+    return EXIT_FAILURE;
+  }
+
+  auto last = reader->latest();
+  auto frames = 0;
+  auto torn = 0;
+  auto totalAge = std::chrono::nanoseconds{};
+  auto coverage = 0.0;
+  auto reportAt = std::chrono::steady_clock::now() + std::chrono::seconds{1};
+
+  while (true) {
+    auto key = uint64_t{0};
+    auto pixels = uint64_t{0};
+    auto timestampNs = int64_t{0};
+    auto frame = uint64_t{0};
+    auto const ok = reader->read(last, [&](FrameRing::View view) {
+      frame = view.frame;
+      timestampNs = view.timestampNs;
+      // Only every 16th pixel, this is an example not a benchmark
+      for (auto y = 0u; y < view.height; y += 4) {
+        for (auto x = 0u; x < view.width; x += 4) {
+          key += view.key[y * view.stride + x * 4];
+          pixels += 1;
+        }
+      }
+    });
+
+    if (ok) {
+      last = frame;
+      frames += 1;
+      totalAge += std::chrono::steady_clock::now().time_since_epoch() -
+                  std::chrono::nanoseconds{timestampNs};
+      coverage += static_cast<double>(key) / (pixels * 255);
+    } else if (frame != 0) {
+      // It was overwritten while we were reading it
+      last = frame;
+      torn += 1;
+    } else {
+      std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    }
+
+    if (auto const now = std::chrono::steady_clock::now(); now >= reportAt) {
+      if (frames > 0) {
+        std::cout << frames << " fps, "
+                  << std::chrono::duration<double, std::milli>{totalAge}
+                             .count() /
+                         frames
+                  << " ms old, " << 100 * coverage / frames << "% keyed, "
+                  << torn << " torn\n";
+      } else {
+        std::cout << "No frames, " << torn << " torn\n";
+      }
+      frames = 0;
+      torn = 0;
+      totalAge = {};
+      coverage = 0;
+      reportAt = now + std::chrono::seconds{1};
+    }
+  }
+}
@@ -2,22 +2,49 @@
 #include "include/base/cef_logging.h"
 #include "include/cef_app.h"
 #include "include/cef_command_line.h"
+#include "include/cef_task.h"
 
+#ifndef WIN32
+#include "FrameRing.hpp"
+#endif
+#include "FrameClock.hpp"
+#include "FrameHash.hpp"
+#include "Kernels.hpp"
 #include "KeyFill.hpp"
 #include "Light2D.hpp"
 #include "NDI.hpp"
+#include "NDIOutput.hpp"
+#include "Overlay.hpp"
+#include "PageBridge.hpp"
+#include "PageMetrics.hpp"
+#include "Prefetch.hpp"
+#include "RenderThread.hpp"
+#include "Scheme.hpp"
+#include "SchemeHandler.hpp"
+#include "Stills.hpp"
+#include "ThreadPool.hpp"
+#include "Watchdog.hpp"
 #include "WebServer.hpp"
 
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
 #include <condition_variable>
 #include <cstdlib>
 #include <filesystem>
 #include <fstream>
+#include <functional>
+#include <iterator>
+#include <limits>
 #include <memory>
 #include <mutex>
 #include <optional>
 #include <sstream>
 #include <string>
 #include <thread>
+#include <type_traits>
+#include <vector>
 
 #include <fmt/core.h>
 
@@ -49,27 +76,30 @@ static auto const config_dir =
 #endif
 
 static auto const video_dir = config_dir / "videos"_p;
+static auto const bundle_dir = config_dir / "bundles"_p;
+static auto const still_dir = config_dir / "stills"_p;
+static auto const cef_dir = config_dir / "cef"_p;
 
 constexpr auto index_html1 = R"html(
   <h1>keyfillwebview Control Panel</h1>
   <h3>System</h3>
-  <button onclick="fetch(&quot;/shutdown&quot;, {method: &quot;post&quot;})">Shutdown</button>
+  <button onclick="fetch(&quot;shutdown&quot;, {method: &quot;post&quot;})">Shutdown</button>
   <hr/>
   <h3>Loaded Page</h3>
   <label for="url">URL:</label>
   <input type="text" id="url">
   <button id="load">Load</button>
   <button id="reload">Reload</button>
-  <button onclick="fetch(&quot;/reload&quot;, {method: &quot;post&quot;})">Reload</button>
-  <button onclick="fetch(&quot;/reload_ignoring_cache&quot;, {method: &quot;post&quot;})">
+  <button onclick="fetch(&quot;reload&quot;, {method: &quot;post&quot;})">Reload</button>
+  <button onclick="fetch(&quot;reload_ignoring_cache&quot;, {method: &quot;post&quot;})">
     Reload Ignoring Cache
   </button>
   <button id="force_load">Force Load</button>
   <button id="set_default">Set Default</button>
-  <button onclick="fetch(&quot;/reset&quot;, {method: &quot;post&quot;})">Reset</button>
+  <button onclick="fetch(&quot;reset&quot;, {method: &quot;post&quot;})">Reset</button>
   <h4>Visibility</h4>
-  <button onclick="fetch(&quot;/show&quot;,  {method: &quot;post&quot;})">Show</button>
-  <button onclick="fetch(&quot;/clear&quot;, {method: &quot;post&quot;})">Clear</button>
+  <button onclick="fetch(&quot;show&quot;,  {method: &quot;post&quot;})">Show</button>
+  <button onclick="fetch(&quot;clear&quot;, {method: &quot;post&quot;})">Clear</button>
   <hr/>
   <h3>NDI</h3>
   <select name="select_ndi" id="select_ndi">
@@ -77,12 +107,16 @@ constexpr auto index_html1 = R"html(
 constexpr auto index_html2 = R"html(
   </select>
   <button id="show_ndi">Show</button>
-  <button onclick="fetch(&quot;/hide_ndi&quot;, {method: &quot;post&quot;})">Hide</button>
+  <button onclick="fetch(&quot;hide_ndi&quot;, {method: &quot;post&quot;})">Hide</button>
   <hr/>
   <h3>Upload Video</h3>
   <input type="file" id="upload_video_file"/>
   <button id="upload_video">Upload</button>
   <hr/>
+  <h3>Upload Bundle</h3>
+  <input type="file" id="upload_bundle_file" accept=".zip"/>
+  <button id="upload_bundle">Upload</button>
+  <hr/>
   <h3>Play Video</h3>
   <select name="select_video" id="select_video">
 )html";
@@ -90,15 +124,15 @@ constexpr auto index_html3 = R"html(
   </select>
   <button id="load_video">Load</button>
   <button id="load_video_looping">Load (Looping)</button>
-  <button onclick="fetch(&quot;/play_video&quot;,  {method: &quot;post&quot;})">Play </button>
-  <button onclick="fetch(&quot;/pause_video&quot;, {method: &quot;post&quot;})">Pause</button>
+  <button onclick="fetch(&quot;play_video&quot;,  {method: &quot;post&quot;})">Play </button>
+  <button onclick="fetch(&quot;pause_video&quot;, {method: &quot;post&quot;})">Pause</button>
   <script type="text/javascript">
     const url = document.getElementById("url");
 
     document.getElementById("load").onclick = async _ => {
       try {
         const response = await fetch
-          ( "/load"
+          ( "load"
           , { method: "post"
             , body: url.value
             }
@@ -111,7 +145,7 @@ constexpr auto index_html3 = R"html(
     document.getElementById("force_load").onclick = async _ => {
       try {
         const response = await fetch
-          ( "/force_load"
+          ( "force_load"
           , { method: "post"
             , body: url.value
             }
@@ -124,7 +158,7 @@ constexpr auto index_html3 = R"html(
     document.getElementById("set_default").onclick = async _ => {
       try {
         const response = await fetch
-          ( "/set_default"
+          ( "set_default"
           , { method: "post"
             , body: url.value
             }
@@ -137,7 +171,7 @@ constexpr auto index_html3 = R"html(
     document.getElementById("show_ndi").onclick = async _ => {
       try {
         const response = await fetch
-          ( "/show_ndi"
+          ( "show_ndi"
           , { method: "post"
             , body: document.getElementById("select_ndi").value
             }
@@ -151,7 +185,7 @@ constexpr auto index_html3 = R"html(
       try {
         const file = document.getElementById("upload_video_file").files[0];
         const response = await fetch
-          ( "/upload_video/" + file.name
+          ( "upload_video/" + file.name
           , { method: "post"
             , body: file
             }
@@ -162,10 +196,24 @@ constexpr auto index_html3 = R"html(
       }
     };
 
+    document.getElementById("upload_bundle").onclick = async _ => {
+      try {
+        const file = document.getElementById("upload_bundle_file").files[0];
+        const response = await fetch
+          ( "upload_bundle/" + file.name.replace(/\.zip$/, "")
+          , { method: "post"
+            , body: file
+            }
+          );
+      } catch(err) {
+        console.error(`Error: ${err}`);
+      }
+    };
+
     document.getElementById("load_video").onclick = async _ => {
       try {
         const response = await fetch
-          ( "/load_video"
+          ( "load_video"
           , { method: "post"
             , body: document.getElementById("select_video").value
             }
@@ -178,7 +226,7 @@ constexpr auto index_html3 = R"html(
     document.getElementById("load_video_looping").onclick = async _ => {
       try {
         const response = await fetch
-          ( "/load_video_looping"
+          ( "load_video_looping"
           , { method: "post"
             , body: document.getElementById("select_video").value
             }
@@ -249,21 +297,10 @@ constexpr auto video_player_html = R"html(
       video.loop = params.get("looping") === "true";
       video.onended = () => window.location = params.get("returnto");
 
-      fetch("/play_video", {method: "post"});
-
-      document.onkeydown = e => {
-        switch (e.key) {
-          case "0":
-            video.play();
-            break;
-          case "1":
-            video.pause();
-            break;
-          default:
-            console.log("Unknown key: " + e.key);
-            break;
-        }
-      };
+      keyfill.on("play", () => video.play());
+      keyfill.on("pause", () => video.pause());
+
+      video.play();
     </script>
   </body>
 </html>
@@ -283,22 +320,385 @@ private:
   void Visit(CefString const &str) override { f(str); }
 };
 
-enum class Mode { Show, Clear };
+template <typename F> class Task : public CefTask {
+  // Include the default reference counting implementation.
+  IMPLEMENT_REFCOUNTING(Task);
+
+private:
+  F f;
+
+public:
+  Task(F f) : f{std::move(f)} {}
+
+private:
+  void Execute() override { f(); }
+};
+
+// Replaces any NDI output that is already running
+auto startNDIOutput(KeyFill::Windows &keyFill, NDIlib const &ndilib,
+                    std::string const &name, NDIOutput::Mode mode,
+                    Kernels::Split split, int frameRateN, int frameRateD)
+    -> bool {
+  // The old sender has to go first in case it has the same name
+  keyFill.removeSink("ndi");
+  auto sender = std::make_shared<NDIOutput::Sender>(
+      ndilib, name, mode, split, frameRateN, frameRateD);
+  if (!sender->ok()) {
+    return false;
+  }
+  keyFill.addSink("ndi", [sender](KeyFill::Frame const &frame) {
+    (*sender)(frame);
+  });
+  return true;
+}
+
+#ifndef WIN32
+// Replaces any shared memory output that is already running
+auto startFrameRing(KeyFill::Windows &keyFill, std::string const &name)
+    -> bool {
+  keyFill.removeSink("shm");
+  auto writer = std::shared_ptr<FrameRing::Writer>{FrameRing::Writer::create(
+      name, KeyFill::outputSize.w, KeyFill::outputSize.h)};
+  if (!writer) {
+    return false;
+  }
+  keyFill.addSink("shm", [writer](KeyFill::Frame const &frame) {
+    writer->write(frame.number, frame.pixels, frame.pitch);
+  });
+  return true;
+}
+#endif
+
+// The value of a switch that is a whole number, or a message and nullopt if it
+// isn't one
+auto wholeSwitch(CefRefPtr<CefCommandLine> commandLine, std::string const &name)
+    -> std::optional<uint64_t> {
+  auto const value = commandLine->GetSwitchValue(name).ToString();
+  auto result = uint64_t{};
+  auto const end = value.data() + value.size();
+  if (auto const [last, error] = std::from_chars(value.data(), end, result);
+      value.empty() || error != std::errc{} || last != end) {
+    std::cerr << "--" << name << " must be a whole number\n";
+    return std::nullopt;
+  }
+  return result;
+}
+
+// A browser with its own layer stack, outputs and NDI receiver. Channels
+// share the CEF context, and so the caches, and the control server.
+struct Channel {
+  size_t number;
+  CefRefPtr<CefBrowser> browser;
+  std::optional<KeyFill::Windows> keyFill;
+  CefRefPtr<PageMetrics::Monitor> metrics;
+  PageBridge::Bridge bridge;
+  Watchdog::Watchdog watchdog;
+  NDIlib_recv_instance_t receiver = nullptr;
+  // What changed in each frame from the browser and the NDI input, the
+  // input is frozen once nothing has for frozenAfter
+  FrameHash::Tiles browserHashes{KeyFill::outputSize};
+  FrameHash::Tiles ndiHashes{KeyFill::outputSize};
+  std::chrono::milliseconds frozenAfter{2000};
+  bool ndiFrozen = false;
+  // Offscreen channels render on their own threads, a window has to render on
+  // the main thread
+  std::optional<RenderThread::RenderThread> renderThread;
+  // Text and shapes drawn without the browser, into the "overlay" layer
+  Overlay::Overlay overlay;
+  // The layers of the stills that have been shown
+  Stills::Layers stills;
+
+  Channel(size_t number, std::string const &overlayFont)
+      : number{number}, metrics{new PageMetrics::Monitor{}},
+        watchdog{prefPath("memoryLimits")}, overlay{overlayFont} {}
+
+  // Channel 0 keeps the names from before there were channels
+  auto suffix() const -> std::string {
+    return number == 0 ? "" : std::to_string(number);
+  }
+
+  auto prefPath(std::string const &name) const -> std::string {
+    return SDL_GetPrefPath("nixCodeX", "keyfillwebview") + name + suffix();
+  }
+
+  auto outputName(std::string const &name) const -> std::string {
+    return number == 0 ? name : fmt::format("{}-{}", name, number);
+  }
+};
+
+using Channels = std::vector<std::unique_ptr<Channel>>;
 
 struct HTTPHandler {
-  CefRefPtr<CefBrowser> &browser;
-  Mode &mode;
+  Channels &channels;
   NDIlib const &ndilib;
   NDIlib_find_instance_t finder;
-  NDIlib_recv_instance_t &receiver;
+  CefRefPtr<Scheme::SchemeHandlerFactory> schemes;
+  Prefetch::Prefetcher &prefetcher;
+  // The rate for outputs that aren't given one
+  FrameClock::Rate frameRate;
+  // Only on the UI thread, made when the main loop starts
+  std::optional<FrameClock::FrameClock> const &frameClock;
+  // Shared by the channels
+  Stills::Cache &stills;
+
+  HTTPHandler(Channels &channels, NDIlib const &ndilib,
+              CefRefPtr<Scheme::SchemeHandlerFactory> schemes,
+              Prefetch::Prefetcher &prefetcher, FrameClock::Rate frameRate,
+              std::optional<FrameClock::FrameClock> const &frameClock,
+              Stills::Cache &stills)
+      : channels{channels}, ndilib{ndilib},
+        finder{ndilib->find_create_v2(nullptr)}, schemes{std::move(schemes)},
+        prefetcher{prefetcher}, frameRate{frameRate}, frameClock{frameClock},
+        stills{stills} {}
+
+  // Keys that are missing keep their current value, null resets a rect
+  static auto applyLayerChanges(CefRefPtr<CefDictionaryValue> changes,
+                                KeyFill::LayerProperties &properties) -> bool {
+    auto rect = [&changes](char const *key, std::optional<L2D::Rect> &rect) {
+      if (!changes->HasKey(key)) {
+        return true;
+      }
+      if (changes->GetType(key) == VTYPE_NULL) {
+        rect = std::nullopt;
+        return true;
+      }
+      auto list = changes->GetList(key);
+      if (!list || list->GetSize() != 4) {
+        return false;
+      }
+      rect = L2D::Rect{static_cast<int>(list->GetDouble(0)),
+                       static_cast<int>(list->GetDouble(1)),
+                       static_cast<int>(list->GetDouble(2)),
+                       static_cast<int>(list->GetDouble(3))};
+      return true;
+    };
+
+    if (changes->HasKey("z")) {
+      properties.z = static_cast<int>(changes->GetDouble("z"));
+    }
+    if (changes->HasKey("visible")) {
+      properties.visible = changes->GetBool("visible");
+    }
+    if (changes->HasKey("opacity")) {
+      properties.opacity = static_cast<float>(changes->GetDouble("opacity"));
+    }
+    return rect("dst", properties.dst) && rect("crop", properties.crop);
+  }
+
+  // {"kind": "cut" | "mix" | "wipe", "frames": n, "easing": "linear" |
+  // "ease_in" | "ease_out" | "ease_in_out"}, all optional
+  static auto parseTransition(CefRefPtr<CefDictionaryValue> value)
+      -> std::optional<KeyFill::Transition> {
+    auto transition = KeyFill::Transition{};
+
+    auto const kind = value->GetString("kind").ToString();
+    if (kind == "mix") {
+      transition.kind = KeyFill::Transition::Kind::Mix;
+    } else if (kind == "wipe") {
+      transition.kind = KeyFill::Transition::Kind::Wipe;
+    } else if (!kind.empty() && kind != "cut") {
+      return std::nullopt;
+    }
+
+    transition.frames = static_cast<int>(value->GetDouble("frames"));
+
+    auto const easing = value->GetString("easing").ToString();
+    if (easing == "ease_in") {
+      transition.easing = KeyFill::Easing::EaseIn;
+    } else if (easing == "ease_out") {
+      transition.easing = KeyFill::Easing::EaseOut;
+    } else if (easing == "ease_in_out") {
+      transition.easing = KeyFill::Easing::EaseInOut;
+    } else if (!easing.empty() && easing != "linear") {
+      return std::nullopt;
+    }
+
+    return transition;
+  }
+
+  // Keys that are missing keep their current value, null clears the clock or
+  // countdown
+  static auto applyOverlayChanges(CefRefPtr<CefDictionaryValue> changes,
+                                  Overlay::Element &element) -> bool {
+    auto number = [&changes](char const *key, auto &value) {
+      if (changes->HasKey(key)) {
+        value = static_cast<std::remove_reference_t<decltype(value)>>(
+            changes->GetDouble(key));
+      }
+    };
+    auto string = [&changes](char const *key, std::string &value) {
+      if (changes->HasKey(key)) {
+        value = changes->GetString(key).ToString();
+      }
+    };
+
+    if (changes->HasKey("kind")) {
+      auto const kind = changes->GetString("kind").ToString();
+      if (kind == "text") {
+        element.kind = Overlay::Element::Kind::Text;
+      } else if (kind == "rect") {
+        element.kind = Overlay::Element::Kind::Rect;
+      } else {
+        return false;
+      }
+    }
+    number("z", element.z);
+    number("opacity", element.opacity);
+    if (changes->HasKey("colour")) {
+      auto list = changes->GetList("colour");
+      if (!list || (list->GetSize() != 3 && list->GetSize() != 4)) {
+        return false;
+      }
+      auto channel = [&list](size_t i) {
+        return static_cast<uint8_t>(
+            std::clamp(list->GetDouble(i), 0.0, 255.0));
+      };
+      element.colour = {channel(0), channel(1), channel(2),
+                        list->GetSize() == 4 ? channel(3) : uint8_t{255}};
+    }
+
+    string("text", element.text);
+    string("font", element.font);
+    number("size", element.size);
+    number("x", element.x);
+    number("y", element.y);
+    if (changes->HasKey("align")) {
+      auto const align = changes->GetString("align").ToString();
+      if (align == "left") {
+        element.align = Overlay::Align::Left;
+      } else if (align == "centre") {
+        element.align = Overlay::Align::Centre;
+      } else if (align == "right") {
+        element.align = Overlay::Align::Right;
+      } else {
+        return false;
+      }
+    }
+    string("clock", element.clock);
+    if (changes->HasKey("countdown")) {
+      if (changes->GetType("countdown") == VTYPE_NULL) {
+        element.until = std::nullopt;
+      } else {
+        element.until =
+            Overlay::SystemClock::now() +
+            std::chrono::duration_cast<Overlay::SystemClock::duration>(
+                std::chrono::duration<double>{
+                    changes->GetDouble("countdown")});
+      }
+    }
+
+    if (changes->HasKey("rect")) {
+      auto list = changes->GetList("rect");
+      if (!list || list->GetSize() != 4) {
+        return false;
+      }
+      element.rect = L2D::Rect{static_cast<int>(list->GetDouble(0)),
+                               static_cast<int>(list->GetDouble(1)),
+                               static_cast<int>(list->GetDouble(2)),
+                               static_cast<int>(list->GetDouble(3))};
+    }
+    number("radius", element.radius);
+    return element.size > 0;
+  }
+
+  // The compositor belongs to the UI thread, so the change is made there and
+  // takes effect in the next output frame. The response gives that frame.
+  template <typename Callback>
+  void changeLayer(Channel &channel, HTTP::Request req, Callback callback,
+                   std::string name,
+                   std::function<bool(KeyFill::LayerProperties &)> change,
+                   KeyFill::Transition transition = {}) {
+    CefPostTask(TID_UI, new Task{[&channel, req = std::move(req),
+                                  callback = std::move(callback),
+                                  name = std::move(name),
+                                  change = std::move(change), transition] {
+                  changeLayerNow(channel, req, callback, name, change,
+                                 transition);
+                }});
+  }
 
-  HTTPHandler(CefRefPtr<CefBrowser> &browser, Mode &mode, NDIlib const &ndilib,
-              NDIlib_recv_instance_t &receiver)
-      : browser{browser}, mode{mode}, ndilib{ndilib},
-        finder{ndilib->find_create_v2(nullptr)}, receiver{receiver} {}
+  // The same, already on the UI thread
+  template <typename Callback>
+  static void
+  changeLayerNow(Channel &channel, HTTP::Request const &req,
+                 Callback const &callback, std::string const &name,
+                 std::function<bool(KeyFill::LayerProperties &)> const &change,
+                 KeyFill::Transition transition) {
+    if (!channel.keyFill) {
+      return callback(
+          HTTP::Response{req, HTTP::Response::Status::ServiceUnavailable,
+                         "Output not yet initialized", "text/html"});
+    }
+    auto properties = channel.keyFill->layer(name);
+    if (!properties) {
+      return callback(HTTP::Response{req, HTTP::Response::Status::NotFound,
+                                     "No such layer", "text/html"});
+    }
+    if (!change(*properties)) {
+      return callback(HTTP::Response{req, HTTP::Response::Status::BadRequest,
+                                     "Rects are [x, y, w, h]", "text/html"});
+    }
+    channel.keyFill->setLayer(name, *properties, transition);
+    channel.keyFill->afterNextFrame([req, callback](uint64_t frame) {
+      callback(HTTP::Response{req, HTTP::Response::Status::Ok,
+                              fmt::format(R"({{"frame":{}}})", frame),
+                              "application/json"});
+    });
+  }
+
+  // Responds once the page has acknowledged the command
+  template <typename Callback>
+  void sendCommand(Channel &channel, HTTP::Request req, Callback callback,
+                   std::string name, CefRefPtr<CefValue> payload) {
+    CefPostTask(TID_UI, new Task{[&channel, req = std::move(req),
+                                  callback = std::move(callback),
+                                  name = std::move(name), payload] {
+                  channel.bridge.send(name, payload, [req, callback](PageBridge::Ack ack) {
+                    auto const body =
+                        fmt::format(R"({{"result":{},"latency_ms":{:.3f}}})",
+                                    ack.result, ack.latencyMs);
+                    switch (ack.status) {
+                    case PageBridge::Ack::Status::Ok:
+                      callback(HTTP::Response{req, HTTP::Response::Status::Ok,
+                                              body, "application/json"});
+                      break;
+                    case PageBridge::Ack::Status::Failed:
+                      callback(HTTP::Response{
+                          req, HTTP::Response::Status::InternalServerError,
+                          body, "application/json"});
+                      break;
+                    case PageBridge::Ack::Status::TimedOut:
+                      callback(HTTP::Response{
+                          req, HTTP::Response::Status::GatewayTimeout, body,
+                          "application/json"});
+                      break;
+                    }
+                  });
+                }});
+  }
 
+  // /channel/{n}/... is the same as ... but for channel n, anything else is
+  // for channel 0
   template <typename Callback>
   auto operator()(HTTP::Request req, Callback callback) {
+    auto channel = size_t{0};
+    if (req.target.find("/channel/") == 0) {
+      auto const start = sizeof("/channel/") - 1;
+      auto const end = req.target.find('/', start);
+      auto const number = req.target.substr(start, end - start);
+      if (end == std::string::npos || number.empty() || number.size() > 4 ||
+          number.find_first_not_of("0123456789") != std::string::npos ||
+          (channel = std::stoul(number)) >= channels.size()) {
+        return callback(HTTP::Response{req, HTTP::Response::Status::NotFound,
+                                       "No such channel", "text/html"});
+      }
+      req.target = req.target.substr(end);
+    }
+    route(*channels[channel], std::move(req), std::move(callback));
+  }
+
+  template <typename Callback>
+  void route(Channel &channel, HTTP::Request req, Callback callback) {
     if (req.method == HTTP::Request::Verb::Post && req.target == "/shutdown") {
 #ifdef WIN32
       auto process = HANDLE{};
@@ -340,16 +740,17 @@ struct HTTPHandler {
 #endif
     } else if (req.method == HTTP::Request::Verb::Post &&
                req.target == "/load") {
-      if (browser) {
-        auto frame = browser->GetMainFrame();
+      if (channel.browser) {
+        auto frame = channel.browser->GetMainFrame();
         frame->GetSource(new StringVisitor{
-            [frame, req = std::move(req),
+            [&channel, frame, req = std::move(req),
              callback = std::move(callback)](CefString const &source) {
               auto source_stdstr = source.ToString();
               if (source_stdstr.find(
                       "<title>keyfillwebview instructions</title>") !=
                       std::string::npos ||
                   source_stdstr == "<html><head></head><body></body></html>") {
+                channel.bridge.navigate(req.body);
                 frame->LoadURL(req.body);
                 callback(HTTP::Response{req, HTTP::Response::Status::Ok, "",
                                         "text/html"});
@@ -364,8 +765,8 @@ struct HTTPHandler {
       }
     } else if (req.method == HTTP::Request::Verb::Post &&
                req.target == "/reload") {
-      if (browser) {
-        browser->Reload();
+      if (channel.browser) {
+        channel.browser->Reload();
         callback(
             HTTP::Response{req, HTTP::Response::Status::Ok, "", "text/html"});
       } else {
@@ -374,8 +775,8 @@ struct HTTPHandler {
       }
     } else if (req.method == HTTP::Request::Verb::Post &&
                req.target == "/reload_ignoring_cache") {
-      if (browser) {
-        browser->ReloadIgnoreCache();
+      if (channel.browser) {
+        channel.browser->ReloadIgnoreCache();
         callback(
             HTTP::Response{req, HTTP::Response::Status::Ok, "", "text/html"});
       } else {
@@ -384,8 +785,9 @@ struct HTTPHandler {
       }
     } else if (req.method == HTTP::Request::Verb::Post &&
                req.target == "/force_load") {
-      if (browser) {
-        browser->GetMainFrame()->LoadURL(req.body);
+      if (channel.browser) {
+        channel.bridge.navigate(req.body);
+        channel.browser->GetMainFrame()->LoadURL(req.body);
         callback(
             HTTP::Response{req, HTTP::Response::Status::Ok, "", "text/html"});
       } else {
@@ -394,15 +796,14 @@ struct HTTPHandler {
       }
     } else if (req.method == HTTP::Request::Verb::Post &&
                req.target == "/set_default") {
-      auto defaultUrlFile = std::ofstream{
-          SDL_GetPrefPath("nixCodeX", "keyfillwebview") + "defaultUrl"s};
+      auto defaultUrlFile = std::ofstream{channel.prefPath("defaultUrl")};
       defaultUrlFile << req.body;
       callback(
           HTTP::Response{req, HTTP::Response::Status::Ok, "", "text/html"});
     } else if (req.method == HTTP::Request::Verb::Post &&
                req.target == "/is_active") {
-      if (browser) {
-        auto frame = browser->GetMainFrame();
+      if (channel.browser) {
+        auto frame = channel.browser->GetMainFrame();
         frame->GetSource(new StringVisitor{
             [frame, req = std::move(req),
              callback = std::move(callback)](CefString const &source) {
@@ -424,8 +825,9 @@ struct HTTPHandler {
       }
     } else if (req.method == HTTP::Request::Verb::Post &&
                req.target == "/reset") {
-      if (browser) {
-        browser->GetMainFrame()->LoadURL("http://127.0.0.1:8080/instructions");
+      if (channel.browser) {
+        channel.browser->GetMainFrame()->LoadURL(
+            fmt::format("{}/instructions", Scheme::app));
         callback(
             HTTP::Response{req, HTTP::Response::Status::Ok, "", "text/html"});
       } else {
@@ -433,22 +835,150 @@ struct HTTPHandler {
                                 "Browser not yet initialized", "text/html"});
       }
     } else if (req.method == HTTP::Request::Verb::Post &&
-               req.target == "/show") {
-      mode = Mode::Show;
-      browser->GetHost()->Invalidate(PET_VIEW);
-    } else if (req.method == HTTP::Request::Verb::Post &&
-               req.target == "/clear") {
-      mode = Mode::Clear;
-      browser->GetHost()->Invalidate(PET_VIEW);
+               (req.target == "/show" || req.target == "/clear")) {
+      auto const visible = req.target == "/show";
+      auto transition = std::optional{KeyFill::Transition{}};
+      if (!req.body.empty()) {
+        auto value = CefParseJSON(req.body, JSON_PARSER_RFC);
+        if (!value || value->GetType() != VTYPE_DICTIONARY) {
+          return callback(HTTP::Response{req,
+                                         HTTP::Response::Status::BadRequest,
+                                         "Expected a JSON object", "text/html"});
+        }
+        transition = parseTransition(value->GetDictionary());
+      }
+      if (!transition) {
+        return callback(HTTP::Response{req, HTTP::Response::Status::BadRequest,
+                                       "Unknown transition", "text/html"});
+      }
+      changeLayer(
+          channel, std::move(req), std::move(callback), "browser",
+          [visible](KeyFill::LayerProperties &properties) {
+            properties.visible = visible;
+            return true;
+          },
+          *transition);
     } else if (req.method == HTTP::Request::Verb::Post &&
                req.target == "/show_ndi") {
       auto params = NDIlib_recv_create_v3_t{
           NDIlib_source_t{req.body.c_str()}, NDIlib_recv_color_format_BGRX_BGRA,
           NDIlib_recv_bandwidth_highest, false, nullptr};
-      receiver = ndilib->recv_create_v3(&params);
+      channel.receiver = ndilib->recv_create_v3(&params);
     } else if (req.method == HTTP::Request::Verb::Post &&
                req.target == "/hide_ndi") {
-      receiver = nullptr;
+      channel.receiver = nullptr;
+    } else if (req.method == HTTP::Request::Verb::Post &&
+               req.target == "/ndi_output") {
+      auto value = CefParseJSON(req.body, JSON_PARSER_RFC);
+      if (!value || value->GetType() != VTYPE_DICTIONARY) {
+        return callback(HTTP::Response{req, HTTP::Response::Status::BadRequest,
+                                       "Expected a JSON object", "text/html"});
+      }
+      auto const settings = value->GetDictionary();
+
+      auto const modeName = settings->GetString("mode").ToString();
+      auto mode = NDIOutput::Mode::Alpha;
+      if (modeName == "key_fill") {
+        mode = NDIOutput::Mode::KeyFill;
+      } else if (modeName != "alpha") {
+        return callback(HTTP::Response{req, HTTP::Response::Status::BadRequest,
+                                       "Unknown mode", "text/html"});
+      }
+      auto split = Kernels::Split{};
+      auto const fill = settings->GetString("fill").ToString();
+      if (fill == "straight") {
+        split.straight = true;
+      } else if (!fill.empty() && fill != "premultiplied") {
+        return callback(HTTP::Response{req, HTTP::Response::Status::BadRequest,
+                                       "Unknown fill", "text/html"});
+      }
+      auto const range = settings->GetString("range").ToString();
+      if (range == "legal") {
+        split.legal = true;
+      } else if (!range.empty() && range != "full") {
+        return callback(HTTP::Response{req, HTTP::Response::Status::BadRequest,
+                                       "Unknown range", "text/html"});
+      }
+      auto name = settings->HasKey("name")
+                      ? settings->GetString("name").ToString()
+                      : channel.outputName("keyfillwebview");
+      auto frameRateN = static_cast<int>(frameRate.numerator);
+      auto frameRateD = static_cast<int>(frameRate.denominator);
+      if (settings->HasKey("frame_rate")) {
+        auto const frameRate = settings->GetList("frame_rate");
+        // Whole numbers that NDI can take
+        auto const valid = [](double value) {
+          return value >= 1 && value <= std::numeric_limits<int>::max() &&
+                 std::floor(value) == value;
+        };
+        if (!frameRate || frameRate->GetSize() != 2 ||
+            !valid(frameRate->GetDouble(0)) ||
+            !valid(frameRate->GetDouble(1))) {
+          return callback(HTTP::Response{
+              req, HTTP::Response::Status::BadRequest,
+              "frame_rate is [numerator, denominator], positive whole numbers",
+              "text/html"});
+        }
+        frameRateN = static_cast<int>(frameRate->GetDouble(0));
+        frameRateD = static_cast<int>(frameRate->GetDouble(1));
+      }
+
+      CefPostTask(TID_UI, new Task{[this, &channel, req, callback,
+                                    name = std::move(name), mode, split,
+                                    frameRateN, frameRateD] {
+                    if (!channel.keyFill) {
+                      return callback(HTTP::Response{
+                          req, HTTP::Response::Status::ServiceUnavailable,
+                          "Output not yet initialized", "text/html"});
+                    }
+                    if (!startNDIOutput(*channel.keyFill, ndilib, name, mode,
+                                        split, frameRateN, frameRateD)) {
+                      return callback(HTTP::Response{
+                          req, HTTP::Response::Status::InternalServerError,
+                          "Could not create NDI sender", "text/html"});
+                    }
+                    callback(HTTP::Response{req, HTTP::Response::Status::Ok,
+                                            "", "text/html"});
+                  }});
+    } else if (req.method == HTTP::Request::Verb::Post &&
+               req.target == "/stop_ndi_output") {
+      CefPostTask(TID_UI, new Task{[&channel, req, callback] {
+                    if (channel.keyFill) {
+                      channel.keyFill->removeSink("ndi");
+                    }
+                    callback(HTTP::Response{req, HTTP::Response::Status::Ok,
+                                            "", "text/html"});
+                  }});
+#ifndef WIN32
+    } else if (req.method == HTTP::Request::Verb::Post &&
+               req.target == "/shm_output") {
+      auto name =
+          req.body.empty() ? channel.outputName("/keyfillwebview") : req.body;
+      CefPostTask(TID_UI, new Task{[&channel, req, callback,
+                                    name = std::move(name)] {
+                    if (!channel.keyFill) {
+                      return callback(HTTP::Response{
+                          req, HTTP::Response::Status::ServiceUnavailable,
+                          "Output not yet initialized", "text/html"});
+                    }
+                    if (!startFrameRing(*channel.keyFill, name)) {
+                      return callback(HTTP::Response{
+                          req, HTTP::Response::Status::InternalServerError,
+                          "Could not create shared memory", "text/html"});
+                    }
+                    callback(HTTP::Response{req, HTTP::Response::Status::Ok,
+                                            "", "text/html"});
+                  }});
+    } else if (req.method == HTTP::Request::Verb::Post &&
+               req.target == "/stop_shm_output") {
+      CefPostTask(TID_UI, new Task{[&channel, req, callback] {
+                    if (channel.keyFill) {
+                      channel.keyFill->removeSink("shm");
+                    }
+                    callback(HTTP::Response{req, HTTP::Response::Status::Ok,
+                                            "", "text/html"});
+                  }});
+#endif
     } else if (req.method == HTTP::Request::Verb::Post &&
                req.target.find("/upload_video/") == 0) {
       auto const filename = req.target.substr(sizeof("/upload_video/") - 1);
@@ -463,19 +993,39 @@ struct HTTPHandler {
       f.write(req.body.data(), req.body.size());
       callback(
           HTTP::Response{req, HTTP::Response::Status::Ok, "", "text/html"});
+    } else if (req.method == HTTP::Request::Verb::Post &&
+               req.target.find("/upload_bundle/") == 0) {
+      auto const name = req.target.substr(sizeof("/upload_bundle/") - 1);
+      if (name.empty() || name.find_first_of("/\\") != std::string::npos) {
+        return callback(HTTP::Response{req, HTTP::Response::Status::BadRequest,
+                                       "Invalid bundle name", "text/html"});
+      }
+      auto ec = std::error_code{};
+      std::filesystem::create_directories(bundle_dir, ec);
+      if (ec) {
+        return callback(
+            HTTP::Response{req, HTTP::Response::Status::InternalServerError,
+                           "Could not create bundle directory", "text/html"});
+      }
+      {
+        auto f = std::ofstream{bundle_dir / (name + ".zip"), std::ios::binary};
+        f.write(req.body.data(), req.body.size());
+      }
+      schemes->evict(name);
+      callback(
+          HTTP::Response{req, HTTP::Response::Status::Ok, "", "text/html"});
     } else if (req.method == HTTP::Request::Verb::Post &&
                req.target == "/load_video") {
-      if (browser) {
-        auto frame = browser->GetMainFrame();
+      if (channel.browser) {
+        auto frame = channel.browser->GetMainFrame();
         auto returnto = frame->GetURL().ToString();
-        if (returnto.find("http://127.0.0.1:8080/video_player") == 0) {
+        if (returnto.find(fmt::format("{}/video_player", Scheme::app)) == 0) {
           returnto = returnto.substr(returnto.find("&returnto=") +
                                      sizeof("&returnto=") - 1);
         }
         frame->LoadURL(
-            fmt::format("http://127.0.0.1:8080/"
-                        "video_player?video={}&looping=false&returnto={}",
-                        req.body, returnto));
+            fmt::format("{}/video_player?video={}&looping=false&returnto={}",
+                        Scheme::app, req.body, returnto));
         callback(
             HTTP::Response{req, HTTP::Response::Status::Ok, "", "text/html"});
       } else {
@@ -484,17 +1034,16 @@ struct HTTPHandler {
       }
     } else if (req.method == HTTP::Request::Verb::Post &&
                req.target == "/load_video_looping") {
-      if (browser) {
-        auto frame = browser->GetMainFrame();
+      if (channel.browser) {
+        auto frame = channel.browser->GetMainFrame();
         auto returnto = frame->GetURL().ToString();
-        if (returnto.find("http://127.0.0.1:8080/video_player") == 0) {
+        if (returnto.find(fmt::format("{}/video_player", Scheme::app)) == 0) {
           returnto = returnto.substr(returnto.find("&returnto=") +
                                      sizeof("&returnto=") - 1);
         }
         frame->LoadURL(
-            fmt::format("http://127.0.0.1:8080/"
-                        "video_player?video={}&looping=true&returnto={}",
-                        req.body, returnto));
+            fmt::format("{}/video_player?video={}&looping=true&returnto={}",
+                        Scheme::app, req.body, returnto));
         callback(
             HTTP::Response{req, HTTP::Response::Status::Ok, "", "text/html"});
       } else {
@@ -503,31 +1052,320 @@ struct HTTPHandler {
       }
     } else if (req.method == HTTP::Request::Verb::Post &&
                req.target == "/play_video") {
-      if (browser) {
-        // browser->GetMainFrame()->ExecuteJavaScript(R"(document.getElementsByTagName("video")[0].play())",
-        // "", 0);
-        auto keyEvent = CefKeyEvent{};
-        keyEvent.type = KEYEVENT_KEYDOWN;
-        keyEvent.character = '0';
-        keyEvent.windows_key_code = 0x30;
-        browser->GetHost()->SendKeyEvent(keyEvent);
-        callback(
-            HTTP::Response{req, HTTP::Response::Status::Ok, "", "text/html"});
+      if (channel.browser) {
+        sendCommand(channel, std::move(req), std::move(callback), "play",
+                    PageBridge::Bridge::parsePayload(""));
       } else {
         callback(HTTP::Response{req, HTTP::Response::Status::ServiceUnavailable,
                                 "Browser not yet initialized", "text/html"});
       }
     } else if (req.method == HTTP::Request::Verb::Post &&
                req.target == "/pause_video") {
-      if (browser) {
-        browser->GetMainFrame()->ExecuteJavaScript(
-            R"(document.getElementsByTagName("video")[0].pause())", "", 0);
-        callback(
-            HTTP::Response{req, HTTP::Response::Status::Ok, "", "text/html"});
+      if (channel.browser) {
+        sendCommand(channel, std::move(req), std::move(callback), "pause",
+                    PageBridge::Bridge::parsePayload(""));
       } else {
         callback(HTTP::Response{req, HTTP::Response::Status::ServiceUnavailable,
                                 "Browser not yet initialized", "text/html"});
       }
+    } else if (req.method == HTTP::Request::Verb::Post &&
+               req.target.find("/command/") == 0) {
+      auto name = req.target.substr(sizeof("/command/") - 1);
+      auto payload = PageBridge::Bridge::parsePayload(req.body);
+      if (!channel.browser) {
+        callback(HTTP::Response{req, HTTP::Response::Status::ServiceUnavailable,
+                                "Browser not yet initialized", "text/html"});
+      } else if (!payload) {
+        callback(HTTP::Response{req, HTTP::Response::Status::BadRequest,
+                                "Payload is not valid JSON", "text/html"});
+      } else {
+        sendCommand(channel, std::move(req), std::move(callback),
+                    std::move(name), payload);
+      }
+    } else if (req.target == "/metrics") {
+      if (channel.browser) {
+        callback(HTTP::Response{req, HTTP::Response::Status::Ok,
+                                channel.metrics->snapshot().json(),
+                                "application/json"});
+      } else {
+        callback(HTTP::Response{req, HTTP::Response::Status::ServiceUnavailable,
+                                "Browser not yet initialized", "text/html"});
+      }
+    } else if (req.method == HTTP::Request::Verb::Post &&
+               req.target == "/data") {
+      auto value = CefParseJSON(req.body, JSON_PARSER_RFC);
+      if (!value || value->GetType() != VTYPE_DICTIONARY) {
+        return callback(HTTP::Response{req, HTTP::Response::Status::BadRequest,
+                                       "Expected a JSON object", "text/html"});
+      }
+      channel.bridge.update(value->GetDictionary());
+      callback(
+          HTTP::Response{req, HTTP::Response::Status::Ok, "", "text/html"});
+    } else if (req.target == "/data_stats") {
+      callback(HTTP::Response{req, HTTP::Response::Status::Ok,
+                              channel.bridge.dataStats().json(),
+                              "application/json"});
+    } else if (req.method == HTTP::Request::Verb::Post &&
+               req.target == "/prefetch") {
+      auto urls = std::vector<std::string>{};
+      auto body = std::istringstream{req.body};
+      std::copy(std::istream_iterator<std::string>{body},
+                std::istream_iterator<std::string>{}, std::back_inserter(urls));
+      CefPostTask(TID_UI, new Task{[this, urls = std::move(urls)] {
+                    prefetcher.start(urls);
+                  }});
+      callback(HTTP::Response{req, HTTP::Response::Status::Accepted, "",
+                              "text/html"});
+    } else if (req.target == "/prefetch_status") {
+      callback(HTTP::Response{req, HTTP::Response::Status::Ok,
+                              prefetcher.json(), "application/json"});
+    } else if (req.target == "/inputs") {
+      CefPostTask(TID_UI, new Task{[&channel, req, callback] {
+                    auto const &after = channel.frozenAfter;
+                    callback(HTTP::Response{
+                        req, HTTP::Response::Status::Ok,
+                        fmt::format(R"({{"browser":{},"ndi":{}}})",
+                                    channel.browserHashes.json(after),
+                                    channel.receiver
+                                        ? channel.ndiHashes.json(after)
+                                        : "null"),
+                        "application/json"});
+                  }});
+    } else if (req.target == "/layers") {
+      CefPostTask(TID_UI, new Task{[&channel, req, callback] {
+                    callback(HTTP::Response{
+                        req, HTTP::Response::Status::Ok,
+                        channel.keyFill ? channel.keyFill->json() : "[]",
+                        "application/json"});
+                  }});
+    } else if (req.method == HTTP::Request::Verb::Post &&
+               req.target.find("/layer/") == 0) {
+      auto name = req.target.substr(sizeof("/layer/") - 1);
+      auto value = CefParseJSON(req.body, JSON_PARSER_RFC);
+      if (!value || value->GetType() != VTYPE_DICTIONARY) {
+        return callback(HTTP::Response{req, HTTP::Response::Status::BadRequest,
+                                       "Expected a JSON object", "text/html"});
+      }
+      auto const changes = value->GetDictionary();
+      auto transition = std::optional{KeyFill::Transition{}};
+      if (changes->GetType("transition") == VTYPE_DICTIONARY) {
+        transition = parseTransition(changes->GetDictionary("transition"));
+      }
+      if (!transition) {
+        return callback(HTTP::Response{req, HTTP::Response::Status::BadRequest,
+                                       "Unknown transition", "text/html"});
+      }
+      changeLayer(
+          channel, std::move(req), std::move(callback), std::move(name),
+          [changes](KeyFill::LayerProperties &properties) {
+            return applyLayerChanges(changes, properties);
+          },
+          *transition);
+    } else if (req.target == "/overlay") {
+      CefPostTask(TID_UI, new Task{[&channel, req, callback] {
+                    callback(HTTP::Response{req, HTTP::Response::Status::Ok,
+                                            channel.overlay.json(),
+                                            "application/json"});
+                  }});
+    } else if (req.method == HTTP::Request::Verb::Post &&
+               req.target.find("/overlay/") == 0) {
+      auto id = req.target.substr(sizeof("/overlay/") - 1);
+      auto value = CefParseJSON(req.body, JSON_PARSER_RFC);
+      if (id.empty() || !value || value->GetType() != VTYPE_DICTIONARY) {
+        return callback(HTTP::Response{req, HTTP::Response::Status::BadRequest,
+                                       "Expected a JSON object", "text/html"});
+      }
+      auto const changes = value->GetDictionary();
+      auto transition = std::optional{KeyFill::Transition{}};
+      if (changes->GetType("transition") == VTYPE_DICTIONARY) {
+        transition = parseTransition(changes->GetDictionary("transition"));
+      }
+      if (!transition) {
+        return callback(HTTP::Response{req, HTTP::Response::Status::BadRequest,
+                                       "Unknown transition", "text/html"});
+      }
+      // Changes apply to the element as it is, so they can be partial
+      CefPostTask(
+          TID_UI, new Task{[&channel, req, callback, id = std::move(id),
+                            changes, transition = *transition] {
+            if (!channel.keyFill) {
+              return callback(HTTP::Response{
+                  req, HTTP::Response::Status::ServiceUnavailable,
+                  "Output not yet initialized", "text/html"});
+            }
+            auto element =
+                channel.overlay.element(id).value_or(Overlay::Element{});
+            if (!applyOverlayChanges(changes, element)) {
+              return callback(
+                  HTTP::Response{req, HTTP::Response::Status::BadRequest,
+                                 "Invalid element", "text/html"});
+            }
+            if (!channel.overlay.set(id, std::move(element), transition,
+                                     channel.keyFill->presentedFrames())) {
+              return callback(
+                  HTTP::Response{req, HTTP::Response::Status::BadRequest,
+                                 "Font can't be loaded", "text/html"});
+            }
+            channel.keyFill->afterNextFrame([req, callback](uint64_t frame) {
+              callback(HTTP::Response{req, HTTP::Response::Status::Ok,
+                                      fmt::format(R"({{"frame":{}}})", frame),
+                                      "application/json"});
+            });
+          }});
+    } else if (req.method == HTTP::Request::Verb::Delete &&
+               req.target.find("/overlay/") == 0) {
+      CefPostTask(TID_UI, new Task{[&channel, req, callback] {
+                    auto const id = req.target.substr(sizeof("/overlay/") - 1);
+                    if (!channel.overlay.remove(id)) {
+                      return callback(HTTP::Response{
+                          req, HTTP::Response::Status::NotFound,
+                          "No such element", "text/html"});
+                    }
+                    callback(HTTP::Response{req, HTTP::Response::Status::Ok, "",
+                                            "text/html"});
+                  }});
+    } else if (req.target == "/stills") {
+      callback(HTTP::Response{req, HTTP::Response::Status::Ok, stills.json(),
+                              "application/json"});
+    } else if (req.method == HTTP::Request::Verb::Post &&
+               req.target.find("/upload_still/") == 0) {
+      auto name = req.target.substr(sizeof("/upload_still/") - 1);
+      if (!Stills::validName(name)) {
+        return callback(HTTP::Response{req, HTTP::Response::Status::BadRequest,
+                                       "Invalid still name", "text/html"});
+      }
+      // Decoded here rather than on the UI thread
+      auto image = stills.add(name, req.body);
+      if (!image) {
+        return callback(HTTP::Response{
+            req, HTTP::Response::Status::BadRequest,
+            "Not a PNG, JPEG or WebP image, or it couldn't be saved",
+            "text/html"});
+      }
+      // Written into its layer now so that showing it is instant
+      CefPostTask(TID_UI, new Task{[this, &channel, req, callback,
+                                    name = std::move(name), image] {
+                    if (channel.keyFill) {
+                      channel.stills.prepare(*channel.keyFill, name, *image);
+                    }
+                    callback(HTTP::Response{
+                        req, HTTP::Response::Status::Ok,
+                        fmt::format(R"({{"width":{},"height":{}}})",
+                                    image->surface.width(),
+                                    image->surface.height()),
+                        "application/json"});
+                  }});
+    } else if (req.method == HTTP::Request::Verb::Post &&
+               (req.target.find("/show_still/") == 0 ||
+                req.target.find("/hide_still/") == 0)) {
+      auto const visible = req.target.find("/show_still/") == 0;
+      auto name = req.target.substr(sizeof("/show_still/") - 1);
+      auto changes = CefDictionaryValue::Create();
+      if (!req.body.empty()) {
+        auto value = CefParseJSON(req.body, JSON_PARSER_RFC);
+        if (!value || value->GetType() != VTYPE_DICTIONARY) {
+          return callback(HTTP::Response{req,
+                                         HTTP::Response::Status::BadRequest,
+                                         "Expected a JSON object", "text/html"});
+        }
+        changes = value->GetDictionary();
+      }
+      auto transition = std::optional{KeyFill::Transition{}};
+      if (changes->GetType("transition") == VTYPE_DICTIONARY) {
+        transition = parseTransition(changes->GetDictionary("transition"));
+      }
+      if (!transition) {
+        return callback(HTTP::Response{req, HTTP::Response::Status::BadRequest,
+                                       "Unknown transition", "text/html"});
+      }
+      auto change = [changes, visible](KeyFill::LayerProperties &properties) {
+        properties.visible = visible;
+        return applyLayerChanges(changes, properties);
+      };
+      if (!visible) {
+        return changeLayer(channel, std::move(req), std::move(callback),
+                           Stills::Layers::layerName(name), change,
+                           *transition);
+      }
+      // A still that was evicted is decoded again here, off the UI thread
+      auto image = stills.get(name);
+      if (!image) {
+        return callback(HTTP::Response{req, HTTP::Response::Status::NotFound,
+                                       "No such still", "text/html"});
+      }
+      CefPostTask(
+          TID_UI, new Task{[this, &channel, req, callback,
+                            name = std::move(name), image, change,
+                            transition = *transition] {
+            if (channel.keyFill) {
+              channel.stills.prepare(*channel.keyFill, name, *image);
+            }
+            changeLayerNow(channel, req, callback,
+                           Stills::Layers::layerName(name), change,
+                           transition);
+          }});
+    } else if (req.method == HTTP::Request::Verb::Delete &&
+               req.target.find("/still/") == 0) {
+      if (!stills.remove(req.target.substr(sizeof("/still/") - 1))) {
+        return callback(HTTP::Response{req, HTTP::Response::Status::NotFound,
+                                       "No such still", "text/html"});
+      }
+      // Its layers go from every channel once they aren't drawn
+      callback(
+          HTTP::Response{req, HTTP::Response::Status::Ok, "", "text/html"});
+    } else if (req.target == "/memory") {
+      callback(HTTP::Response{req, HTTP::Response::Status::Ok,
+                              channel.watchdog.snapshot().json(),
+                              "application/json"});
+    } else if (req.method == HTTP::Request::Verb::Post &&
+               req.target == "/set_memory_limits") {
+      auto value = CefParseJSON(req.body, JSON_PARSER_RFC);
+      if (!value || value->GetType() != VTYPE_DICTIONARY) {
+        return callback(HTTP::Response{req, HTTP::Response::Status::BadRequest,
+                                       "Expected a JSON object", "text/html"});
+      }
+      auto limits = value->GetDictionary();
+      constexpr auto megabyte = 1024.0 * 1024.0;
+      auto const rendererResident = limits->GetDouble("renderer_rss_mb");
+      auto const jsHeap = limits->GetDouble("js_heap_mb");
+      // Bigger than this doesn't fit in 64 bits of bytes
+      constexpr auto maxMegabytes = 1e12;
+      if (!(rendererResident >= 0 && rendererResident <= maxMegabytes) ||
+          !(jsHeap >= 0 && jsHeap <= maxMegabytes)) {
+        return callback(HTTP::Response{req, HTTP::Response::Status::BadRequest,
+                                       "Limits are megabytes from 0",
+                                       "text/html"});
+      }
+      channel.watchdog.setLimits(
+          Watchdog::Limits{static_cast<uint64_t>(rendererResident * megabyte),
+                           static_cast<uint64_t>(jsHeap * megabyte)});
+      callback(
+          HTTP::Response{req, HTTP::Response::Status::Ok, "", "text/html"});
+    } else if (req.target == "/frame_pool") {
+      auto const statistics = L2D::FramePool::shared().statistics();
+      callback(HTTP::Response{
+          req, HTTP::Response::Status::Ok,
+          fmt::format(
+              R"({{"allocations":{},"reuses":{},"buffers_in_use":{},)"
+              R"("bytes_in_use":{},"buffers_free":{},"bytes_free":{},)"
+              R"("high_water_bytes":{}}})",
+              statistics.allocations, statistics.reuses,
+              statistics.buffersInUse, statistics.bytesInUse,
+              statistics.buffersFree, statistics.bytesFree,
+              statistics.highWaterBytes),
+          "application/json"});
+    } else if (req.target == "/clock") {
+      CefPostTask(TID_UI, new Task{[this, req, callback] {
+                    callback(HTTP::Response{
+                        req, HTTP::Response::Status::Ok,
+                        frameClock ? frameClock->json() : "null",
+                        "application/json"});
+                  }});
+    } else if (req.target == "/channels") {
+      callback(HTTP::Response{req, HTTP::Response::Status::Ok,
+                              fmt::format(R"({{"channels":{}}})",
+                                          channels.size()),
+                              "application/json"});
     } else if (req.target == "/" || req.target == "/?") {
       auto index_html = std::stringstream{};
       index_html << index_html1;
@@ -595,22 +1433,23 @@ struct KeyFillEvent {
   std::condition_variable &cv;
 };
 
-class Client : public CefClient, CefLifeSpanHandler, CefRenderHandler {
+struct SampleMetricsEvent {};
+
+class Client : public CefClient,
+               CefLifeSpanHandler,
+               CefRenderHandler,
+               CefRequestHandler {
   // Include the default reference counting implementation.
   IMPLEMENT_REFCOUNTING(Client);
 
 private:
-  CefRefPtr<CefBrowser> &_browser;
-  std::optional<KeyFill::Windows> &keyFill;
-  Mode &mode;
+  Channel &channel;
 
   std::condition_variable cv;
   std::mutex mutex;
 
 public:
-  Client(CefRefPtr<CefBrowser> &browser,
-         std::optional<KeyFill::Windows> &keyFill, Mode &mode)
-      : _browser{browser}, keyFill{keyFill}, mode{mode} {}
+  Client(Channel &channel) : channel{channel} {}
 
   // CefClient methods
   auto GetLifeSpanHandler() -> CefRefPtr<CefLifeSpanHandler> override {
@@ -619,10 +1458,45 @@ public:
   auto GetRenderHandler() -> CefRefPtr<CefRenderHandler> override {
     return this;
   }
+  auto GetRequestHandler() -> CefRefPtr<CefRequestHandler> override {
+    return this;
+  }
+
+  auto OnProcessMessageReceived(CefRefPtr<CefBrowser> browser,
+                                CefRefPtr<CefFrame> frame,
+                                CefProcessId source_process,
+                                CefRefPtr<CefProcessMessage> message)
+      -> bool override {
+    return channel.bridge.router()->OnProcessMessageReceived(browser, frame,
+                                                     source_process, message);
+  }
 
   // CefLifeSpanHandler methods
   void OnAfterCreated(CefRefPtr<CefBrowser> browser) override {
-    _browser = browser;
+    channel.browser = browser;
+    channel.metrics->attach(browser);
+  }
+
+  void OnBeforeClose(CefRefPtr<CefBrowser> browser) override {
+    channel.metrics->detach();
+    channel.bridge.router()->OnBeforeClose(browser);
+  }
+
+  // CefRequestHandler methods
+  auto OnBeforeBrowse(CefRefPtr<CefBrowser> browser, CefRefPtr<CefFrame> frame,
+                      CefRefPtr<CefRequest> request, bool user_gesture,
+                      bool is_redirect) -> bool override {
+    channel.bridge.router()->OnBeforeBrowse(browser, frame);
+    // Including navigations by the page itself
+    if (frame->IsMain() && !is_redirect) {
+      channel.bridge.navigate(request->GetURL().ToString());
+    }
+    return false;
+  }
+
+  void OnRenderProcessTerminated(CefRefPtr<CefBrowser> browser,
+                                 TerminationStatus status) override {
+    channel.bridge.router()->OnRenderProcessTerminated(browser);
   }
 
   // CefRenderHandler methods
@@ -639,16 +1513,19 @@ public:
   void OnPaint(CefRefPtr<CefBrowser> browser, PaintElementType type,
                RectList const &dirtyRects, void const *buffer, int width,
                int height) override {
-    if (keyFill) {
-      switch (mode) {
-      case Mode::Show: {
-        auto dst = keyFill->lock(1);
-        std::memcpy(dst.pixels.get(), buffer, dst.pitch * 1080);
+    channel.metrics->onPaint(dirtyRects);
+    // Whether it is shown is up to the compositor
+    if (channel.keyFill) {
+      auto dirty = std::vector<L2D::Rect>{};
+      for (auto const &rect : dirtyRects) {
+        dirty.emplace_back(rect.x, rect.y, rect.width, rect.height);
       }
-        break;
-      case Mode::Clear:
-        keyFill->hide(1);
-        break;
+      // Chromium sometimes paints the same pixels again
+      auto const changed = channel.browserHashes.update(
+          static_cast<uint8_t const *>(buffer), width * 4, dirty);
+      if (!changed.empty()) {
+        auto dst = channel.keyFill->lock("browser", changed);
+        std::memcpy(dst.pixels.get(), buffer, dst.pitch * 1080);
       }
     }
   }
@@ -659,16 +1536,34 @@ class App : public CefApp, CefBrowserProcessHandler {
   IMPLEMENT_REFCOUNTING(App);
 
 private:
-  CefRefPtr<CefBrowser> &_browser;
-  std::optional<KeyFill::Windows> &keyFill;
-  Mode &mode;
+  Channels &channels;
+  CefRefPtr<Scheme::SchemeHandlerFactory> schemes;
 
 public:
-  App(CefRefPtr<CefBrowser> &browser, std::optional<KeyFill::Windows> &keyFill,
-      Mode &mode)
-      : _browser{browser}, keyFill{keyFill}, mode{mode} {}
+  App(Channels &channels, CefRefPtr<Scheme::SchemeHandlerFactory> schemes)
+      : channels{channels}, schemes{std::move(schemes)} {}
 
   // CefApp methods
+  void OnRegisterCustomSchemes(
+      CefRawPtr<CefSchemeRegistrar> registrar) override {
+    Scheme::registerCustomScheme(registrar);
+  }
+
+  void OnBeforeCommandLineProcessing(
+      CefString const &process_type,
+      CefRefPtr<CefCommandLine> command_line) override {
+    // Media is started from the API rather than by a user gesture
+    if (process_type.empty()) {
+      command_line->AppendSwitchWithValue("autoplay-policy",
+                                          "no-user-gesture-required");
+      // Nothing is shown so there's no point in the GPU process
+      if (command_line->HasSwitch("headless")) {
+        command_line->AppendSwitch("disable-gpu");
+        command_line->AppendSwitch("disable-gpu-compositing");
+      }
+    }
+  }
+
   auto GetBrowserProcessHandler()
       -> CefRefPtr<CefBrowserProcessHandler> override {
     return this;
@@ -676,6 +1571,8 @@ public:
 
   // CefBrowserProcessHandler methods
   void OnContextInitialized() override {
+    schemes->registerFactories();
+
     auto info = CefWindowInfo{};
 
     info.SetAsWindowless(0);
@@ -684,22 +1581,24 @@ public:
 
     settings.windowless_frame_rate = 25;
 
-    auto client = CefRefPtr<Client>{new Client{_browser, keyFill, mode}};
-
 #ifdef WIN32
     info.SetAsPopup(nullptr, "Web View");
 #endif
 
-    auto url = "http://127.0.0.1:8080/instructions"s;
+    for (auto &channel : channels) {
+      channel->bridge.start();
+      auto client = CefRefPtr<Client>{new Client{*channel}};
 
-    auto defaultUrlFile = std::ifstream{
-        SDL_GetPrefPath("nixCodeX", "keyfillwebview") + "defaultUrl"s};
-    if (defaultUrlFile) {
-      defaultUrlFile >> url;
-    }
+      auto url = fmt::format("{}/instructions", Scheme::app);
 
-    CefBrowserHost::CreateBrowser(info, client, url, settings, nullptr,
-                                  nullptr);
+      auto defaultUrlFile = std::ifstream{channel->prefPath("defaultUrl")};
+      if (defaultUrlFile) {
+        defaultUrlFile >> url;
+      }
+
+      CefBrowserHost::CreateBrowser(info, client, url, settings, nullptr,
+                                    nullptr);
+    }
   }
 };
 
@@ -795,39 +1694,252 @@ auto main(int argc, char **argv) -> int {
   [Application sharedApplication];
 #endif
 
-  auto browser = CefRefPtr<CefBrowser>{};
-  auto keyFill = std::optional<KeyFill::Windows>{};
-  auto mode = Mode::Show;
-
-  auto app = CefRefPtr<App>{new App{browser, keyFill, mode}};
-
-  if (auto exitCode = CefExecuteProcess(mainArgs, nullptr, nullptr);
+  auto schemes =
+      CefRefPtr<Scheme::SchemeHandlerFactory>{new Scheme::SchemeHandlerFactory{
+          {{"/instructions",
+            {std::make_shared<std::string const>(
+                 fmt::format(instructions_html, asio::ip::host_name())),
+             "text/html"}},
+           {"/video_player",
+            {std::make_shared<std::string const>(video_player_html),
+             "text/html"}}},
+          video_dir, bundle_dir}};
+
+  if (auto exitCode = CefExecuteProcess(
+          mainArgs, new PageBridge::RendererApp{}, nullptr);
       exitCode >= 0) {
     return exitCode;
   }
 
+  auto commandLine = CefCommandLine::CreateCommandLine();
+#ifdef WIN32
+  commandLine->InitFromString(::GetCommandLineW());
+#else
+  commandLine->InitFromArgv(argc, argv);
+#endif
+  // Composite into memory for the sinks, with no window or display
+  auto const headless = commandLine->HasSwitch("headless");
+  // Quits after this many frames, for benchmarks
+  auto maxFrames = uint64_t{0};
+  if (commandLine->HasSwitch("frames")) {
+    auto const frames = wholeSwitch(commandLine, "frames");
+    if (!frames) {
+      return EXIT_FAILURE;
+    }
+    maxFrames = *frames;
+  }
+  // Each channel has its own browser, layers and outputs
+  auto noChannels = size_t{1};
+  if (commandLine->HasSwitch("channels")) {
+    auto const channels = wholeSwitch(commandLine, "channels");
+    if (!channels) {
+      return EXIT_FAILURE;
+    }
+    if (*channels == 0) {
+      std::cerr << "--channels must be at least 1\n";
+      return EXIT_FAILURE;
+    }
+    noChannels = *channels;
+  }
+
+  if (commandLine->HasSwitch("cpu-kernels")) {
+    auto const name = commandLine->GetSwitchValue("cpu-kernels").ToString();
+    auto known = false;
+    for (auto level : {Kernels::Level::Scalar, Kernels::Level::SSE41,
+                       Kernels::Level::AVX2, Kernels::Level::AVX512}) {
+      if (name == Kernels::levelName(level)) {
+        Kernels::limit(level);
+        known = true;
+      }
+    }
+    if (!known) {
+      std::cerr
+          << "--cpu-kernels must be one of scalar, sse4.1, avx2 or avx512\n";
+      return EXIT_FAILURE;
+    }
+  }
+
+  // An NDI input that hasn't changed for this long is reported as frozen
+  auto frozenAfter = std::chrono::milliseconds{2000};
+  if (commandLine->HasSwitch("frozen-after")) {
+    auto const value = commandLine->GetSwitchValue("frozen-after").ToString();
+    char *end = nullptr;
+    auto const seconds = std::strtod(value.c_str(), &end);
+    // A day is more than long enough, and keeps it well inside the duration
+    if (value.empty() || *end != '\0' || !(seconds >= 0 && seconds <= 86400)) {
+      std::cerr << "--frozen-after must be a number of seconds\n";
+      return EXIT_FAILURE;
+    }
+    frozenAfter = std::chrono::milliseconds{std::lround(1000 * seconds)};
+  }
+
+  // Paces the main loop, which otherwise goes as fast as it can or as a
+  // clocked NDI output takes the frames
+  auto frameRate = std::optional<FrameClock::Rate>{};
+  if (commandLine->HasSwitch("frame-rate")) {
+    frameRate = FrameClock::Rate::parse(
+        commandLine->GetSwitchValue("frame-rate").ToString());
+    if (!frameRate) {
+      std::cerr << "--frame-rate must be a rate such as 25, 30000/1001 or "
+                   "59.94\n";
+      return EXIT_FAILURE;
+    }
+  }
+  auto frameClock = std::optional<FrameClock::FrameClock>{};
+
+  // Checked here, the NDI output is started for each channel below
+  auto ndiMode = NDIOutput::Mode::Alpha;
+  auto ndiSplit = Kernels::Split{};
+  if (commandLine->HasSwitch("ndi-output")) {
+    auto const modeName = commandLine->GetSwitchValue("ndi-output").ToString();
+    if (modeName == "key_fill") {
+      ndiMode = NDIOutput::Mode::KeyFill;
+    } else if (!modeName.empty() && modeName != "alpha") {
+      std::cerr << "--ndi-output must be alpha or key_fill\n";
+      return EXIT_FAILURE;
+    }
+    auto const fill = commandLine->GetSwitchValue("ndi-fill").ToString();
+    if (fill == "straight") {
+      ndiSplit.straight = true;
+    } else if (!fill.empty() && fill != "premultiplied") {
+      std::cerr << "--ndi-fill must be premultiplied or straight\n";
+      return EXIT_FAILURE;
+    }
+    auto const range = commandLine->GetSwitchValue("ndi-range").ToString();
+    if (range == "legal") {
+      ndiSplit.legal = true;
+    } else if (!range.empty() && range != "full") {
+      std::cerr << "--ndi-range must be full or legal\n";
+      return EXIT_FAILURE;
+    }
+  }
+
+  // For overlay text that doesn't name a font
+#ifdef WIN32
+  auto overlayFont = "C:/Windows/Fonts/arial.ttf"s;
+#elif defined(__APPLE__)
+  auto overlayFont = "/System/Library/Fonts/Supplemental/Arial.ttf"s;
+#else
+  auto overlayFont = "/usr/share/fonts/truetype/dejavu/DejaVuSans.ttf"s;
+#endif
+  if (commandLine->HasSwitch("overlay-font")) {
+    overlayFont = commandLine->GetSwitchValue("overlay-font").ToString();
+  }
+
+  auto channels = Channels{};
+  for (auto i = size_t{0}; i < noChannels; ++i) {
+    channels.push_back(std::make_unique<Channel>(i, overlayFont));
+    channels.back()->frozenAfter = frozenAfter;
+  }
+
+  auto app = CefRefPtr<App>{new App{channels, schemes}};
+
   auto ndilib = NDIlib{};
-  auto receiver = NDIlib_recv_instance_t{nullptr};
+
+  auto prefetcher = Prefetch::Prefetcher{};
 
   auto const address = boost::asio::ip::make_address("0.0.0.0");
   auto const port = static_cast<unsigned short>(8080);
   auto const noThreads = 4;
 
+  auto l2DInit = L2D::L2DInit{headless ? SDL_INIT_TIMER | SDL_INIT_EVENTS
+                                        : SDL_INIT_EVERYTHING};
+
+  // Decoded stills are kept up to this many megabytes
+  auto stillCache = uint64_t{512};
+  if (commandLine->HasSwitch("still-cache")) {
+    auto const megabytes = wholeSwitch(commandLine, "still-cache");
+    if (!megabytes) {
+      return EXIT_FAILURE;
+    }
+    // Any more doesn't fit in the bytes
+    if (*megabytes > std::numeric_limits<size_t>::max() / (1024 * 1024)) {
+      std::cerr << "--still-cache is too big\n";
+      return EXIT_FAILURE;
+    }
+    stillCache = *megabytes;
+  }
+  auto stills = Stills::Cache{l2DInit, still_dir,
+                              static_cast<size_t>(stillCache) * 1024 * 1024};
+
   auto server = WebServer<HTTPHandler>{
-      HTTPHandler{browser, mode, ndilib, receiver},
+      HTTPHandler{channels, ndilib, schemes, prefetcher,
+                  frameRate.value_or(FrameClock::Rate{}), frameClock, stills},
       boost::asio::ip::tcp::endpoint{address, port}, noThreads};
 
-  auto l2DInit = L2D::L2DInit{};
-
-  keyFill.emplace(l2DInit, "Web View", L2D::Rect{0, 0, 3840, 1080},
-                  SDL_WINDOW_BORDERLESS);
+  for (auto &channel : channels) {
+    // Only the first channel has the window, the others are for the sinks
+    if (headless || channel->number != 0) {
+      channel->keyFill.emplace(KeyFill::Offscreen{});
+      channel->renderThread.emplace();
+    } else if (commandLine->HasSwitch("cpu-compositor")) {
+      channel->keyFill.emplace(KeyFill::CPU{}, l2DInit, "Web View",
+                               L2D::Rect{0, 0, 3840, 1080},
+                               SDL_WINDOW_BORDERLESS);
+      L2D::show_cursor(false);
+    } else {
+      channel->keyFill.emplace(l2DInit, "Web View", L2D::Rect{0, 0, 3840, 1080},
+                               SDL_WINDOW_BORDERLESS);
+      L2D::show_cursor(false);
+    }
+    auto &keyFill = *channel->keyFill;
+    keyFill.addLayer("ndi", {0});
+    keyFill.addLayer("browser", {1});
+
+    if (commandLine->HasSwitch("ndi-output")) {
+      auto const name =
+          commandLine->HasSwitch("ndi-name")
+              ? commandLine->GetSwitchValue("ndi-name").ToString()
+              : "keyfillwebview"s;
+      auto const outputRate = frameRate.value_or(FrameClock::Rate{});
+      if (!startNDIOutput(keyFill, ndilib, channel->outputName(name), ndiMode,
+                          ndiSplit, static_cast<int>(outputRate.numerator),
+                          static_cast<int>(outputRate.denominator))) {
+        std::cerr << "Could not create NDI sender\n";
+      }
+    }
+#ifndef WIN32
+    if (commandLine->HasSwitch("shm-output")) {
+      auto name = commandLine->GetSwitchValue("shm-output").ToString();
+      if (name.empty()) {
+        name = "/keyfillwebview";
+      }
+      if (!startFrameRing(keyFill, channel->outputName(name))) {
+        std::cerr << "Could not create shared memory\n";
+      }
+    }
+#endif
+    if (commandLine->HasSwitch("file-output")) {
+      // Raw BGRA frames, one after the other
+      auto file = std::make_shared<std::ofstream>(
+          channel->outputName(
+              commandLine->GetSwitchValue("file-output").ToString()),
+          std::ios::binary);
+      keyFill.addSink("file", [file](KeyFill::Frame const &frame) {
+        for (auto y = 0; y < frame.size.h; ++y) {
+          file->write(
+              reinterpret_cast<char const *>(frame.pixels + y * frame.pitch),
+              frame.size.w * 4);
+        }
+      });
+    }
+  }
 
-  L2D::show_cursor(false);
+  if (channels.front()->keyFill->compositesOnCPU()) {
+    std::cerr << "Compositing on the CPU with "
+              << Kernels::levelName(Kernels::current().level) << " on "
+              << ThreadPool::ThreadPool::shared().size() + 1 << " threads\n";
+  }
 
   auto settings = CefSettings{};
 
   settings.windowless_rendering_enabled = true;
 
+  // Keep the disk cache between runs so the first show after boot doesn't
+  // have to fetch everything again
+  CefString(&settings.root_cache_path) = cef_dir.string();
+  CefString(&settings.cache_path) = (cef_dir / "cache"_p).string();
+
   CefInitialize(mainArgs, settings, app, nullptr);
 
 #ifdef __APPLE__
@@ -837,20 +1949,34 @@ auto main(int argc, char **argv) -> int {
 #endif
 
   auto refreshTimer = L2D::Timer{
-      2000, [&browser](uint32_t milliseconds) -> uint32_t {
-        if (browser) {
-          auto frame = browser->GetMainFrame();
-          frame->GetSource(new StringVisitor{[browser,
-                                              frame](CefString const &source) {
-            auto source_stdstr = source.ToString();
-            if (source_stdstr == "<html><head></head><body></body></html>") {
-              browser->Reload();
-            }
-          }});
+      2000, [&channels](uint32_t milliseconds) -> uint32_t {
+        for (auto &channel : channels) {
+          if (auto browser = channel->browser) {
+            auto frame = browser->GetMainFrame();
+            frame->GetSource(new StringVisitor{
+                [browser, frame](CefString const &source) {
+                  auto source_stdstr = source.ToString();
+                  if (source_stdstr ==
+                      "<html><head></head><body></body></html>") {
+                    browser->Reload();
+                  }
+                }});
+          }
         }
         return milliseconds;
       }};
 
+  auto sampleMetrics = L2D::Events::Channel<SampleMetricsEvent, 4>{l2DInit};
+  auto metricsTimer = L2D::Timer{
+      1000, [&sampleMetrics](uint32_t milliseconds) -> uint32_t {
+        sampleMetrics.push();
+        return milliseconds;
+      }};
+
+  if (frameRate) {
+    frameClock.emplace(*frameRate);
+  }
+
   auto running = true;
   while (running) {
     while (auto event = L2D::Events::poll()) {
@@ -858,43 +1984,82 @@ auto main(int argc, char **argv) -> int {
       case SDL_QUIT:
         running = false;
         break;
+      case SDL_WINDOWEVENT:
+        // Only channel 0 has a window
+        channels.front()->keyFill->redraw();
+        break;
       case SDL_KEYDOWN:
         if (!event->key.repeat) {
           if (event->key.keysym.sym == SDLK_r &&
               (event->key.keysym.mod & KMOD_CTRL)) {
-            if (browser) {
+            if (auto &browser = channels.front()->browser) {
               browser->Reload();
             }
           }
         }
         break;
       default:
+        // DevTools methods have to be called on the UI thread. Samples that
+        // queued up while the loop was busy are taken as one.
+        if (sampleMetrics.parse(*event)) {
+          while (sampleMetrics.pop()) {
+          }
+          auto pages = std::vector<Watchdog::Page>{};
+          for (auto &channel : channels) {
+            if (!channel->browser) {
+              continue;
+            }
+            channel->metrics->sample(channel->browser);
+            // Still on air while it mixes or wipes out
+            pages.push_back(
+                {channel->watchdog, channel->browser,
+                 static_cast<uint64_t>(channel->metrics->snapshot().jsHeapUsed),
+                 channel->keyFill->drawn("browser")});
+          }
+          Watchdog::check(pages);
+        }
         break;
       }
     }
 
-    if (keyFill) {
-      if (receiver) {
+    for (auto &channel : channels) {
+      auto &keyFill = *channel->keyFill;
+      if (auto receiver = channel->receiver) {
         NDIlib_video_frame_v2_t video_frame;
         switch (ndilib->recv_capture_v3(receiver, &video_frame, nullptr, nullptr,
                                         0)) {
         case NDIlib_frame_type_video: {
-          auto dst = keyFill->lock(0);
           if (video_frame.xres != 1920) {
             std::cerr << "Invalid NDI frame size";
           }
           if (video_frame.yres != 1080) {
             std::cerr << "Invalid NDI frame size";
           }
-          std::memcpy(dst.pixels.get(), video_frame.p_data, dst.pitch * 1080);
+          // A frozen source keeps sending the same frame
+          auto const changed = channel->ndiHashes.update(
+              video_frame.p_data, video_frame.line_stride_in_bytes);
+          if (!changed.empty()) {
+            auto dst = keyFill.lock("ndi", changed);
+            std::memcpy(dst.pixels.get(), video_frame.p_data,
+                        dst.pitch * 1080);
+          }
           ndilib->recv_free_video_v2(receiver, &video_frame);
           break;
         }
         default:
           break;
         }
+        auto const frozen = channel->ndiHashes.frozen(channel->frozenAfter);
+        if (frozen != channel->ndiFrozen) {
+          channel->ndiFrozen = frozen;
+          std::cerr << "Channel " << channel->number << " NDI input "
+                    << (frozen ? "frozen\n" : "changing again\n");
+        }
       } else {
-        keyFill->hide(0);
+        keyFill.hide("ndi");
+        // The first frame from the next source has to be shown whatever it is
+        channel->ndiHashes.reset();
+        channel->ndiFrozen = false;
       }
     }
 
@@ -902,10 +2067,49 @@ auto main(int argc, char **argv) -> int {
     // Should use CefSettings.external_message_pump option and
     // CefBrowserProcessHandler::OnScheduleMessagePumpWork()
 
-    keyFill->render();
+    for (auto &channel : channels) {
+      channel->bridge.expire();
+      if (channel->browser) {
+        channel->bridge.flush(channel->browser);
+      }
+    }
+
+    for (auto &channel : channels) {
+      channel->overlay.update(*channel->keyFill);
+      // Layers of stills that were evicted or deleted, as soon as they aren't
+      // drawn
+      channel->stills.prune(*channel->keyFill, stills);
+    }
+
+    if (frameClock) {
+      frameClock->wait();
+    }
+
+    // The channels render at the same time, nothing else touches their layers
+    // until they have all finished
+    for (auto &channel : channels) {
+      if (channel->renderThread) {
+        channel->renderThread->start([&keyFill = *channel->keyFill] {
+          keyFill.render();
+        });
+      }
+    }
+    for (auto &channel : channels) {
+      if (channel->renderThread) {
+        channel->renderThread->wait();
+      } else {
+        channel->keyFill->render();
+      }
+    }
+    if (maxFrames != 0 &&
+        channels.front()->keyFill->presentedFrames() >= maxFrames) {
+      running = false;
+    }
   }
 
-  browser = nullptr;
+  for (auto &channel : channels) {
+    channel->browser = nullptr;
+  }
 
   CefShutdown();
 
@@ -5,6 +5,8 @@
 #include "include/cef_app.h"
 #include "include/wrapper/cef_library_loader.h"
 
+#include "PageBridge.hpp"
+
 // When generating projects with CMake the CEF_USE_SANDBOX value will be defined
 // automatically. Pass -DUSE_SANDBOX=OFF to the CMake command-line to disable
 // use of the sandbox.
@@ -30,6 +32,9 @@ int main(int argc, char* argv[]) {
   // Provide CEF with command-line arguments.
   CefMainArgs main_args(argc, argv);
 
+  // Handles the page bridge in the render processes.
+  CefRefPtr<PageBridge::RendererApp> app(new PageBridge::RendererApp);
+
   // Execute the sub-process.
-  return CefExecuteProcess(main_args, nullptr, nullptr);
+  return CefExecuteProcess(main_args, app, nullptr);
 }